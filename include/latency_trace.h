@@ -0,0 +1,220 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include "pipeline.h"
+
+// End-to-end latency tracing: packet arrival -> pushed into the ring ->
+// first sample of the packet popped by the PWM ISR (and written with
+// ledcWrite()). Keeps a latency histogram, underrun counts and a ring of
+// trace events that export as Chrome trace JSON (chrome://tracing or
+// ui.perfetto.dev).
+//
+// Also implements the low-latency mode: with -DLOW_LATENCY_DEPTH=n, every
+// arriving packet first trims the ring to at most n samples, so latency
+// is bounded by n plus one packet. Every trim drops queued audio, so the
+// cost is the underrun rate plus the trimmed samples.
+//
+// No Arduino dependencies; timestamps come from the caller, so
+// tools/pcm_replay.cpp runs the same code on simulated time.
+// Tracing is on by default, build with -DLATENCY_TRACE=0 to compile it out.
+
+#ifndef LATENCY_TRACE
+#define LATENCY_TRACE 1
+#endif
+
+#ifndef LOW_LATENCY_DEPTH
+#define LOW_LATENCY_DEPTH 0   // samples, 0 = off
+#endif
+
+// Sizes, both must be powers of two
+static const uint32_t TRACE_EVENTS = 512;
+static const uint32_t TRACE_MARKS  = 16;  // packets in flight through the ring
+
+static const uint32_t LAT_BINS   = 64;    // plus one overflow bin
+static const uint32_t LAT_BIN_US = 1000;
+
+enum trace_type : uint16_t {
+  TR_DEPTH,     // ring depth at packet arrival (samples)
+  TR_PROCESS,   // arrival -> last sample pushed (us)
+  TR_LATENCY,   // arrival -> first sample out (us)
+  TR_UNDERRUN,  // ISR found the ring empty for `value` us
+  TR_TRIM,      // low-latency mode dropped `value` queued samples
+};
+
+struct trace_event {
+  uint32_t t_us;
+  uint32_t value;
+  uint16_t type;
+  uint16_t id;    // packet number
+};
+
+struct trace_mark {
+  uint32_t index;  // sample count through the ring at the packet's start
+  uint32_t t_us;
+  uint16_t id;
+};
+
+struct latency_trace {
+  trace_event events[TRACE_EVENTS];
+  uint32_t n_events;
+  volatile bool frozen;     // set while dumping
+
+  trace_mark marks[TRACE_MARKS];
+  uint32_t mark_head, mark_tail;
+  uint32_t produced;        // samples accepted into the ring
+  uint32_t consumed;        // samples popped or trimmed
+  uint16_t next_id;
+
+  uint32_t hist[LAT_BINS + 1];
+  uint32_t lat_min, lat_max, lat_count;
+  uint64_t lat_sum;
+
+  uint32_t ticks;           // ISR ticks seen
+  uint32_t underrun_ticks;
+  uint32_t underrun_start;
+  bool in_underrun;
+
+  uint32_t trimmed;         // samples dropped by low-latency trims
+  uint32_t trims;           // packets that trimmed anything
+};
+
+static inline void trace_emit(latency_trace *tr, uint16_t type,
+                              uint16_t id, uint32_t t_us, uint32_t value) {
+  if (!LATENCY_TRACE || tr->frozen) return;
+  trace_event *e = &tr->events[tr->n_events & (TRACE_EVENTS - 1)];
+  e->t_us = t_us;
+  e->value = value;
+  e->type = type;
+  e->id = id;
+  tr->n_events++;
+}
+
+// Called on packet arrival, before anything is pushed. Trims the ring to
+// `keep` samples unless 0 (LOW_LATENCY_DEPTH on the device) and returns
+// the packet id for trace_packet_end().
+static inline uint16_t trace_packet_begin(latency_trace *tr, sample_ring *rb,
+                                          uint32_t t_us, uint32_t keep) {
+  uint16_t id = tr->next_id++;
+  trace_emit(tr, TR_DEPTH, id, t_us, rb_depth(rb));
+
+  if (keep) {
+    uint32_t n = rb_trim(rb, keep);
+    if (n) {
+      tr->consumed += n;
+      tr->trimmed += n;
+      tr->trims++;
+      trace_emit(tr, TR_TRIM, id, t_us, n);
+    }
+  }
+
+  if (LATENCY_TRACE && tr->mark_head - tr->mark_tail < TRACE_MARKS) {
+    trace_mark *m = &tr->marks[tr->mark_head & (TRACE_MARKS - 1)];
+    m->index = tr->produced;
+    m->t_us = t_us;
+    m->id = id;
+    tr->mark_head++;
+  }
+  return id;
+}
+
+// Called after the packet is pushed; `accepted` excludes overflow drops
+static inline void trace_packet_end(latency_trace *tr, uint16_t id,
+                                    uint32_t t_begin, uint32_t t_end,
+                                    uint32_t accepted) {
+  tr->produced += accepted;
+  trace_emit(tr, TR_PROCESS, id, t_begin, t_end - t_begin);
+}
+
+// Called from the ISR once per tick, `underrun` if the ring was empty
+static inline void trace_tick(latency_trace *tr, uint32_t t_us, bool underrun) {
+  tr->ticks++;
+
+  if (underrun) {
+    tr->underrun_ticks++;
+    if (!tr->in_underrun) {
+      tr->in_underrun = true;
+      tr->underrun_start = t_us;
+    }
+    return;
+  }
+  if (tr->in_underrun) {
+    tr->in_underrun = false;
+    trace_emit(tr, TR_UNDERRUN, 0, tr->underrun_start, t_us - tr->underrun_start);
+  }
+
+  tr->consumed++;
+  while (tr->mark_head != tr->mark_tail) {
+    trace_mark *m = &tr->marks[tr->mark_tail & (TRACE_MARKS - 1)];
+    if ((int32_t)(tr->consumed - m->index) <= 0) break;
+
+    uint32_t lat = t_us - m->t_us;
+    uint32_t bin = lat / LAT_BIN_US;
+    tr->hist[bin < LAT_BINS ? bin : LAT_BINS]++;
+    if (tr->lat_count == 0 || lat < tr->lat_min) tr->lat_min = lat;
+    if (lat > tr->lat_max) tr->lat_max = lat;
+    tr->lat_sum += lat;
+    tr->lat_count++;
+
+    trace_emit(tr, TR_LATENCY, m->id, m->t_us, lat);
+    tr->mark_tail++;
+  }
+}
+
+// ======================== Export ============================
+// Chrome trace JSON. Call trace_json_event() for i in [first, n_events)
+// between the head and tail strings; `first` skips overwritten events.
+
+static const char TRACE_JSON_HEAD[] =
+    "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"input\"}},\n"
+    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"ring\"}},\n"
+    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"pwm isr\"}}";
+static const char TRACE_JSON_TAIL[] = "\n]}\n";
+
+static inline uint32_t trace_first(const latency_trace *tr) {
+  return tr->n_events > TRACE_EVENTS ? tr->n_events - TRACE_EVENTS : 0;
+}
+
+// Format event i (with a leading ",\n") into buf, returns its length
+static inline int trace_json_event(const latency_trace *tr, uint32_t i,
+                                   char *buf, size_t n) {
+  const trace_event *e = &tr->events[i & (TRACE_EVENTS - 1)];
+  unsigned long t = e->t_us, v = e->value;
+  unsigned id = e->id;
+
+  switch (e->type) {
+    case TR_DEPTH:
+      return snprintf(buf, n,
+          ",\n{\"name\":\"ring depth\",\"ph\":\"C\",\"ts\":%lu,\"pid\":1,"
+          "\"args\":{\"samples\":%lu}}", t, v);
+    case TR_PROCESS:
+      return snprintf(buf, n,
+          ",\n{\"name\":\"packet %u\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,"
+          "\"pid\":1,\"tid\":1}", id, t, v);
+    case TR_LATENCY:
+      // async span so overlapping packets stay readable
+      return snprintf(buf, n,
+          ",\n{\"name\":\"packet %u\",\"cat\":\"latency\",\"ph\":\"b\",\"id\":%u,"
+          "\"ts\":%lu,\"pid\":1,\"tid\":2}"
+          ",\n{\"name\":\"packet %u\",\"cat\":\"latency\",\"ph\":\"e\",\"id\":%u,"
+          "\"ts\":%lu,\"pid\":1,\"tid\":2}", id, id, t, id, id, t + v);
+    case TR_UNDERRUN:
+      return snprintf(buf, n,
+          ",\n{\"name\":\"underrun\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,"
+          "\"pid\":1,\"tid\":3}", t, v);
+    case TR_TRIM:
+      return snprintf(buf, n,
+          ",\n{\"name\":\"trim\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lu,\"pid\":1,"
+          "\"tid\":2,\"args\":{\"packet\":%u,\"samples\":%lu}}", t, id, v);
+  }
+  buf[0] = 0;
+  return 0;
+}
+
+#ifdef ARDUINO
+class Print;
+
+// Serial dumps, see src/latency_trace.cpp
+void trace_dump_json(Print &out, latency_trace *tr);
+void trace_dump_summary(Print &out, const latency_trace *tr, uint32_t fs_ring);
+#endif
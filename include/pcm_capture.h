@@ -0,0 +1,52 @@
+#pragma once
+#include <Arduino.h>
+
+// Field capture of the packets fed into the envelope pipeline.
+// Each packet is stored as (push time, arrival time, byte length, mono
+// PCM) in a RAM ring that always holds the most recent CAPTURE_SAMPLES
+// samples; a dump over Serial can be fed to tools/pcm_replay.cpp to
+// reproduce the exact ring buffer behavior on the host.
+//
+// A glitch (underrun run or overflow drop) arms a trigger: recording goes
+// on for CAPTURE_POST_PACKETS more packets and then holds, so the packets
+// around the glitch survive until someone sends 'c'. Dumping re-arms it.
+//
+// Recording is one copy of the mono samples per packet, so it is left on
+// by default. Build with -DPCM_CAPTURE=0 to compile it out.
+
+#ifndef PCM_CAPTURE
+#define PCM_CAPTURE 1
+#endif
+
+// Capture sizes, both must be powers of two
+static const uint32_t CAPTURE_SAMPLES = 16384;  // 32 KB of PCM, ~0.4 s
+static const uint32_t CAPTURE_PACKETS = 64;
+static const uint32_t CAPTURE_POST_PACKETS = 16;  // recorded after a trigger
+
+#if PCM_CAPTURE
+// Report a glitch seen before the next packet, ignored while one is pending
+void pcm_capture_trigger();
+
+// True once a triggered capture is held and waiting for a dump
+bool pcm_capture_held();
+
+// Record one packet. `t_us` is when it is pushed into the ring and `t_rx`
+// when it arrived (earlier on the UDP path, by the network and jitter
+// buffer delay). `len` is the packet size in bytes as delivered, `pcm`
+// points at the first sample of `frames` frames spaced `stride` apart.
+void pcm_capture_packet(uint32_t t_us, uint32_t t_rx, uint32_t len,
+                        const int16_t *pcm, uint32_t frames, uint32_t stride);
+
+// Freeze the capture and print it to `out` in the text format read by
+// tools/pcm_replay.cpp. Recording resumes when the dump is done.
+// Packets are recorded at fs_env; the header carries the ring rate `fc`
+// and the upsample mode so the replay can rebuild the ring's contents.
+void pcm_capture_dump(Print &out, uint32_t fs_env, uint32_t fc, int up_mode,
+                      int duty_min, int duty_max);
+#else
+static inline void pcm_capture_trigger() {}
+static inline bool pcm_capture_held() { return false; }
+static inline void pcm_capture_packet(uint32_t, uint32_t, uint32_t,
+                                      const int16_t *, uint32_t, uint32_t) {}
+static inline void pcm_capture_dump(Print &, uint32_t, uint32_t, int, int, int) {}
+#endif
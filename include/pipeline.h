@@ -0,0 +1,118 @@
+#pragma once
+#include <stdint.h>
+
+// Portable part of the envelope pipeline: the sample ring between the
+// audio callback and the PWM ISR, and the sample -> duty mapping.
+// No Arduino dependencies, so the host tools in tools/ build the exact
+// same code the firmware runs.
+
+// ======================= Ring buffer ========================
+// Simple mono sample ring buffer (int16_t). Size is a power of two, set
+// per deployment with -DRB_BITS=n (512 samples by default).
+#ifndef RB_BITS
+#define RB_BITS 9
+#endif
+static const uint32_t RB_SIZE = 1u << RB_BITS;
+
+struct sample_ring {
+  volatile int16_t data[RB_SIZE];
+  volatile uint32_t head;       // write index
+  volatile uint32_t tail;       // read index
+  volatile uint32_t drops;      // samples dropped on overflow
+  volatile uint32_t underruns;  // ISR ticks that found the ring empty
+};
+
+static inline uint32_t rb_depth(const sample_ring *rb) {
+  return (rb->head - rb->tail) & (RB_SIZE - 1);
+}
+
+static inline bool rb_is_full(const sample_ring *rb) {
+  uint32_t next = (rb->head + 1) & (RB_SIZE - 1);
+  return next == rb->tail;
+}
+
+static inline bool rb_is_empty(const sample_ring *rb) {
+  return rb->head == rb->tail;
+}
+
+// push from callback
+static inline void rb_push(sample_ring *rb, int16_t v) {
+  uint32_t h = rb->head;
+  uint32_t next = (h + 1) & (RB_SIZE - 1);
+  if (next == rb->tail) {
+    // overflow: drop sample
+    rb->drops = rb->drops + 1;
+    return;
+  }
+  rb->data[h] = v;
+  rb->head = next;
+}
+
+// pop from ISR
+static inline int16_t rb_pop_or_last(sample_ring *rb, int16_t last) {
+  if (rb_is_empty(rb)) {
+    rb->underruns = rb->underruns + 1;
+    return last;
+  }
+  uint32_t t = rb->tail;
+  int16_t v = rb->data[t];
+  rb->tail = (t + 1) & (RB_SIZE - 1);
+  return v;
+}
+
+// drop the oldest samples so at most `keep` remain, returns how many went
+static inline uint32_t rb_trim(sample_ring *rb, uint32_t keep) {
+  uint32_t d = rb_depth(rb);
+  if (d <= keep) return 0;
+  rb->tail = (rb->tail + (d - keep)) & (RB_SIZE - 1);
+  return d - keep;
+}
+
+// ======================= Modulation =========================
+static inline uint16_t clamp_u16(uint32_t x, uint16_t lo, uint16_t hi) {
+  if (x < lo) return lo;
+  if (x > hi) return hi;
+  return (uint16_t)x;
+}
+
+// Modulation index in Q15 with 1 bit of headroom: MOD_FULL maps full-scale
+// PCM onto 0..32767, i.e. 100 % AM. Larger values overmodulate and clip.
+static const int32_t MOD_FULL = 32768;
+
+// Envelope in 0..32767 before clamping, outside that range the sample clips
+static inline int32_t envelope_from_sample(int16_t s, int32_t mod_q15) {
+  // Scale from signed 16-bit to 0..32767 (envelope)
+  int32_t interp = (s * mod_q15) >> 16;  // headroom
+  interp += 16384;                        // DC bias to center
+  return interp;
+}
+
+// Map an envelope value to a PWM duty code in [duty_min..duty_max]
+static inline uint16_t duty_from_envelope(int32_t interp, int duty_min, int duty_max) {
+  if (interp < 0)     interp = 0;
+  if (interp > 32767) interp = 32767;
+
+  uint32_t duty =
+      duty_min +
+      ((uint32_t)interp * (duty_max - duty_min)) / 32767;
+
+  return clamp_u16(duty, duty_min, duty_max);
+}
+
+// Map a signed PCM sample to a PWM duty code in [duty_min..duty_max]
+static inline uint16_t duty_from_sample(int16_t s, int duty_min, int duty_max) {
+  return duty_from_envelope(envelope_from_sample(s, MOD_FULL), duty_min, duty_max);
+}
+
+// ======================= Filtering ==========================
+// 1-pole low-pass, y += (x - y) * alpha. alpha = 4096 (1/8) is the
+// ">> 3" filter of the old audio pipeline, ~7 kHz at 48 kHz.
+struct lpf1 {
+  int32_t y;
+  int32_t alpha_q15;  // 32768 = pass-through
+};
+
+static inline int16_t lpf1_step(lpf1 *f, int16_t x) {
+  f->y += ((x - f->y) * f->alpha_q15) >> 15;
+  return (int16_t)f->y;
+}
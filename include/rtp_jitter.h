@@ -0,0 +1,229 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// RTP/L16 parsing and a small jitter buffer for the UDP input path.
+// No Arduino dependencies: the firmware (src/udp_input.cpp) and the host
+// loopback test (tools/rtp_loopback.cpp) run the same code.
+//
+// Payload is L16 (RFC 3551): big-endian signed 16-bit, interleaved when
+// stereo. Only the left channel is kept, same as the A2DP path.
+
+// ======================= RTP parsing ========================
+struct rtp_packet {
+  uint16_t seq;
+  uint32_t timestamp;
+  uint8_t  payload_type;
+  const uint8_t *payload;
+  uint32_t payload_len;
+};
+
+// Returns false for anything that is not a well-formed RTP v2 packet
+static inline bool rtp_parse(const uint8_t *p, uint32_t len, rtp_packet *out) {
+  if (len < 12 || (p[0] >> 6) != 2) return false;
+
+  uint32_t hdr = 12 + 4 * (p[0] & 0x0F);          // CSRC list
+  if (p[0] & 0x10) {                              // header extension
+    if (len < hdr + 4) return false;
+    hdr += 4 + 4 * ((p[hdr + 2] << 8) | p[hdr + 3]);
+  }
+  uint32_t pad = (p[0] & 0x20) ? p[len - 1] : 0;  // padding
+  if (len < hdr + pad) return false;
+
+  out->payload_type = p[1] & 0x7F;
+  out->seq = (uint16_t)((p[2] << 8) | p[3]);
+  out->timestamp = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) |
+                   ((uint32_t)p[6] << 8) | p[7];
+  out->payload = p + hdr;
+  out->payload_len = len - hdr - pad;
+  return true;
+}
+
+// ====================== Jitter buffer =======================
+// Slots are indexed by sequence number, sizes must be powers of two
+static const uint32_t JB_SLOTS      = 16;
+static const uint32_t JB_MAX_FRAMES = 256;
+
+// Backlog control: after JB_DRAIN_AFTER consecutive gets with more than
+// target + JB_DRAIN_MARGIN packets buffered (the burst after a receive
+// stall), the oldest packets are skipped in one go back down to target.
+static const uint32_t JB_DRAIN_MARGIN = 2;
+static const uint32_t JB_DRAIN_AFTER  = 8;
+
+enum jb_result {
+  JB_EMPTY,      // nothing to play, buffer is (re)priming
+  JB_OK,         // next packet in sequence
+  JB_CONCEALED,  // packet missing, output is a faded repeat of the last one
+};
+
+struct jb_slot {
+  uint32_t t_us;       // receive time
+  uint16_t seq;
+  uint16_t frames;
+  bool valid;
+  int16_t pcm[JB_MAX_FRAMES];
+};
+
+struct jitter_buffer {
+  jb_slot slots[JB_SLOTS];
+  int16_t last[JB_MAX_FRAMES];  // last packet played, for concealment
+  uint16_t last_frames;
+  uint16_t next_seq;            // next sequence number to play
+  uint32_t buffered;            // valid slots
+  uint32_t target;              // packets to hold before playing
+  uint32_t lost_run;            // consecutive concealed packets
+  uint32_t high_run;            // consecutive gets above the drain mark
+  bool started;
+  bool primed;
+
+  // stats
+  uint32_t received;
+  uint32_t late;                // arrived after their slot was played
+  uint32_t duplicates;
+  uint32_t concealed;
+  uint32_t overruns;            // buffered packets pushed out by newer ones
+  uint32_t resyncs;             // sender jumped too far ahead or back
+  uint32_t drained;             // buffered packets skipped to cut latency
+  uint32_t drains;              // times the backlog was cut
+};
+
+static inline void jb_init(jitter_buffer *jb, uint32_t target) {
+  memset(jb, 0, sizeof(*jb));
+  if (target < 1) target = 1;
+  if (target > JB_SLOTS - 1) target = JB_SLOTS - 1;
+  jb->target = target;
+}
+
+static inline void jb_reset(jitter_buffer *jb) {
+  for (uint32_t i = 0; i < JB_SLOTS; i++) jb->slots[i].valid = false;
+  jb->buffered = 0;
+  jb->high_run = 0;
+  jb->started = false;
+  jb->primed = false;
+}
+
+// Skip the oldest packets (and any gaps between them) until `target` are
+// left. One jump instead of a slow drift, so it is a single glitch.
+static inline void jb_drain(jitter_buffer *jb) {
+  while (jb->buffered > jb->target) {
+    jb_slot *s = &jb->slots[jb->next_seq & (JB_SLOTS - 1)];
+    if (s->valid && s->seq == jb->next_seq) {
+      s->valid = false;
+      jb->buffered--;
+      jb->drained++;
+    }
+    jb->next_seq++;
+  }
+  jb->lost_run = 0;
+  jb->drains++;
+}
+
+// Store one RTP payload received at `t_us`, converting L16 to native mono
+// samples
+static inline void jb_put(jitter_buffer *jb, uint16_t seq, uint32_t t_us,
+                          const uint8_t *payload, uint32_t len, uint32_t channels) {
+  jb->received++;
+
+  if (!jb->started) {
+    jb->started = true;
+    jb->next_seq = seq;
+  }
+
+  int32_t ahead = (int16_t)(seq - jb->next_seq);
+  if (ahead < -(int32_t)JB_SLOTS || ahead >= (int32_t)(2 * JB_SLOTS)) {
+    // Sender restarted (RTP picks a random first sequence number, so it is
+    // as likely to land behind as ahead) or a long outage: drop everything
+    // and follow it
+    jb->resyncs++;
+    jb->overruns += jb->buffered;
+    jb_reset(jb);
+    jb->started = true;
+    jb->next_seq = seq;
+  } else if (ahead < 0) {
+    jb->late++;
+    return;
+  } else if ((uint32_t)ahead >= JB_SLOTS) {
+    // Burst after a playout stall: slide the window, oldest packets go
+    while ((uint16_t)(seq - jb->next_seq) >= JB_SLOTS) {
+      jb_slot *old = &jb->slots[jb->next_seq & (JB_SLOTS - 1)];
+      if (old->valid) {
+        old->valid = false;
+        jb->buffered--;
+        jb->overruns++;
+      }
+      jb->next_seq++;
+    }
+  }
+
+  jb_slot *s = &jb->slots[seq & (JB_SLOTS - 1)];
+  if (s->valid) {
+    jb->duplicates++;
+    return;
+  }
+
+  uint32_t frames = len / (2 * channels);
+  if (frames > JB_MAX_FRAMES) frames = JB_MAX_FRAMES;
+  for (uint32_t i = 0; i < frames; i++) {
+    const uint8_t *b = payload + 2 * channels * i;
+    s->pcm[i] = (int16_t)((b[0] << 8) | b[1]);
+  }
+  s->t_us = t_us;
+  s->seq = seq;
+  s->frames = (uint16_t)frames;
+  s->valid = true;
+  jb->buffered++;
+}
+
+// Take the next packet to play. `out` must hold JB_MAX_FRAMES samples.
+// For JB_OK, `t_us` is the packet's receive time; concealed packets never
+// arrived and leave it untouched.
+static inline jb_result jb_get(jitter_buffer *jb, int16_t *out, uint32_t *frames,
+                               uint32_t *t_us) {
+  *frames = 0;
+
+  if (!jb->primed) {
+    if (jb->buffered < jb->target) return JB_EMPTY;
+    jb->primed = true;
+  }
+
+  if (jb->buffered > jb->target + JB_DRAIN_MARGIN) {
+    if (++jb->high_run >= JB_DRAIN_AFTER) {
+      jb->high_run = 0;
+      jb_drain(jb);
+    }
+  } else {
+    jb->high_run = 0;
+  }
+
+  jb_slot *s = &jb->slots[jb->next_seq & (JB_SLOTS - 1)];
+  if (s->valid && s->seq == jb->next_seq) {
+    memcpy(out, s->pcm, 2 * s->frames);
+    memcpy(jb->last, s->pcm, 2 * s->frames);
+    jb->last_frames = s->frames;
+    *frames = s->frames;
+    *t_us = s->t_us;
+    s->valid = false;
+    jb->buffered--;
+    jb->next_seq++;
+    jb->lost_run = 0;
+    return JB_OK;
+  }
+
+  if (jb->buffered == 0) {
+    // Stream stopped or stalled: hold output and wait for `target` again
+    jb->primed = false;
+    return JB_EMPTY;
+  }
+
+  // Missing packet with later ones waiting: repeat the last packet,
+  // halving its level for every further consecutive loss
+  uint32_t shift = ++jb->lost_run;
+  if (shift > 15) shift = 15;
+  for (uint32_t i = 0; i < jb->last_frames; i++) {
+    out[i] = (int16_t)(jb->last[i] >> shift);
+  }
+  *frames = jb->last_frames;
+  jb->concealed++;
+  jb->next_seq++;
+  return JB_CONCEALED;
+}
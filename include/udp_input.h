@@ -0,0 +1,33 @@
+#pragma once
+#include <Arduino.h>
+
+// Low-latency Wi-Fi input: RTP/L16 PCM over UDP, as an alternative to the
+// A2DP sink. Packets go through the jitter buffer in rtp_jitter.h and are
+// handed to `sink` a packet at a time, keeping about UDP_RING_FILL samples
+// queued ahead of the PWM ISR.
+//
+// The sender must use the input rate (FS_ENV) as its sample rate, e.g.
+//   ffmpeg -re -i in.wav -ac 1 -ar 44100 -acodec pcm_s16be
+//          -f rtp "rtp://<ip>:5004?pkt_size=268"
+
+#ifndef INPUT_UDP
+#define INPUT_UDP 0
+#endif
+
+static const uint16_t UDP_PORT      = 5004;
+static const uint32_t UDP_CHANNELS  = 1;    // L16 channels in the payload
+static const uint32_t UDP_JB_TARGET = 2;    // packets held before playout
+static const uint32_t UDP_RING_FILL = 256;  // samples queued in the ring
+static const uint32_t UDP_CONNECT_MS = 20000;  // Wi-Fi association timeout
+
+// `t_rx` is when the datagram arrived, before the jitter buffer
+typedef void (*pcm_sink_fn)(uint32_t t_rx, const int16_t *pcm, uint32_t frames);
+typedef uint32_t (*ring_depth_fn)();
+
+// Connect to Wi-Fi and start the receive task. Returns false, with a
+// message on Serial, if the connection fails within UDP_CONNECT_MS.
+bool udp_input_begin(const char *ssid, const char *pass,
+                     pcm_sink_fn sink, ring_depth_fn depth);
+
+// Print jitter buffer counters
+void udp_input_stats(Print &out);
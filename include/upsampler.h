@@ -0,0 +1,137 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Rate conversion of the envelope from the input rate (FS_ENV) to one
+// sample per carrier period (FC), computed a block at a time in the input
+// callback so the PWM ISR only pops a sample per period. Replaces the
+// sample-and-hold staircase of a free-running envelope clock.
+//
+// Interpolation is hold, linear or cubic (Catmull-Rom); pick with
+// -DUPSAMPLE_MODE=UPSAMPLE_LINEAR etc., cubic by default.
+//
+// When FS_ENV > FC (44.1 or 48 kHz A2DP into a 40 kHz carrier) the
+// conversion decimates, and input above FC/2 would fold back into the
+// audio band: 20-24 kHz lands on 16-20 kHz. A 4th-order Butterworth
+// low-pass at UPSAMPLE_LP_CUTOFF * FC runs on the input first in that
+// case: -3 dB at 18 kHz, -25 dB at 20 kHz and -50 dB at 21 kHz from
+// 44.1 kHz input. -DUPSAMPLE_LP_CUTOFF=0 turns it off.
+
+enum upsample_mode {
+  UPSAMPLE_HOLD,
+  UPSAMPLE_LINEAR,
+  UPSAMPLE_CUBIC,
+};
+
+#ifndef UPSAMPLE_MODE
+#define UPSAMPLE_MODE UPSAMPLE_CUBIC
+#endif
+
+#ifndef UPSAMPLE_LP_CUTOFF
+#define UPSAMPLE_LP_CUTOFF 0.45  // anti-alias corner, fraction of fs_out
+#endif
+
+// Anti-alias low-pass: two biquads in transposed direct form II, float
+// like the cubic. Designed only when fs_in > fs_out, else a pass-through.
+struct upsample_lp {
+  int sections;
+  float b0[2], b1[2], b2[2], a1[2], a2[2];
+  float z1[2], z2[2];
+};
+
+static inline void upsample_lp_init(upsample_lp *lp, uint32_t fs_in, uint32_t fs_out) {
+  memset(lp, 0, sizeof(*lp));
+  if (fs_in <= fs_out || UPSAMPLE_LP_CUTOFF <= 0) return;
+
+  // Butterworth pole pair Qs for 4th order, RBJ low-pass sections
+  static const double q[2] = {0.54119610, 1.30656296};
+  double w0 = 2.0 * M_PI * UPSAMPLE_LP_CUTOFF * fs_out / fs_in;
+  double c = cos(w0);
+  for (int i = 0; i < 2; i++) {
+    double alpha = sin(w0) / (2.0 * q[i]), a0 = 1.0 + alpha;
+    lp->b0[i] = lp->b2[i] = (float)((1.0 - c) / 2.0 / a0);
+    lp->b1[i] = (float)((1.0 - c) / a0);
+    lp->a1[i] = (float)(-2.0 * c / a0);
+    lp->a2[i] = (float)((1.0 - alpha) / a0);
+  }
+  lp->sections = 2;
+}
+
+static inline float upsample_lp_step(upsample_lp *lp, float x) {
+  for (int i = 0; i < lp->sections; i++) {
+    float y = lp->b0[i] * x + lp->z1[i];
+    lp->z1[i] = lp->b1[i] * x - lp->a1[i] * y + lp->z2[i];
+    lp->z2[i] = lp->b2[i] * x - lp->a2[i] * y;
+    x = y;
+  }
+  return x;
+}
+
+// Output positions are tracked exactly in units of 1/fs_out input samples,
+// so the output rate has no rounding drift against the input.
+struct upsampler {
+  uint32_t fs_in, fs_out;
+  uint32_t phase;   // output position between x1 and x2, 0..fs_out
+  uint64_t recip;   // 2^47 / fs_out, turns phase into a Q15 fraction
+  int16_t x0, x1, x2, x3;
+  upsample_lp lp;
+};
+
+static inline void upsampler_init(upsampler *u, uint32_t fs_in, uint32_t fs_out) {
+  memset(u, 0, sizeof(*u));
+  u->fs_in = fs_in;
+  u->fs_out = fs_out;
+  u->recip = ((uint64_t)1 << 47) / fs_out;
+  upsample_lp_init(&u->lp, fs_in, fs_out);
+}
+
+// Upper bound on the outputs produced by n inputs
+static inline uint32_t upsample_max_out(const upsampler *u, uint32_t n) {
+  return (uint32_t)((uint64_t)n * u->fs_out / u->fs_in) + 2;
+}
+
+static inline int16_t upsample_interp(const upsampler *u, int mode) {
+  if (mode == UPSAMPLE_HOLD) return u->x1;
+
+  int32_t f = (int32_t)((u->phase * u->recip) >> 32);  // Q15
+  if (mode == UPSAMPLE_LINEAR) {
+    return (int16_t)(u->x1 + (((int32_t)(u->x2 - u->x1) * f) >> 15));
+  }
+
+  // Catmull-Rom through x0..x3, float is fine outside the ISR
+  float t = f * (1.0f / 32768.0f);
+  float x0 = u->x0, x1 = u->x1, x2 = u->x2, x3 = u->x3;
+  float y = x1 + 0.5f * t * (x2 - x0 +
+            t * (2.0f * x0 - 5.0f * x1 + 4.0f * x2 - x3 +
+            t * (3.0f * (x1 - x2) + x3 - x0)));
+  if (y > 32767.0f)  return 32767;
+  if (y < -32768.0f) return -32768;
+  return (int16_t)y;
+}
+
+// Upsample n input samples spaced `stride` apart into `out`, which must
+// hold upsample_max_out(u, n) samples. Returns the number written. Output
+// lags the input by two samples so the cubic taps are always available.
+static inline uint32_t upsample_block(upsampler *u, const int16_t *in, uint32_t n,
+                                      uint32_t stride, int mode, int16_t *out) {
+  uint32_t m = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    u->x0 = u->x1;
+    u->x1 = u->x2;
+    u->x2 = u->x3;
+    u->x3 = in[i * stride];
+    if (u->lp.sections) {
+      float y = upsample_lp_step(&u->lp, u->x3);
+      y = y > 32767.0f ? 32767.0f : (y < -32768.0f ? -32768.0f : y);
+      u->x3 = (int16_t)lrintf(y);
+    }
+
+    while (u->phase < u->fs_out) {
+      out[m++] = upsample_interp(u, mode);
+      u->phase += u->fs_in;
+    }
+    u->phase -= u->fs_out;
+  }
+  return m;
+}
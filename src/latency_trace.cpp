@@ -0,0 +1,47 @@
+#include <Arduino.h>
+#include "latency_trace.h"
+
+void trace_dump_json(Print &out, latency_trace *tr) {
+  char buf[320];
+
+  // Stop recording so the ISR doesn't overwrite what is being printed
+  tr->frozen = true;
+
+  out.println("#trace");
+  out.print(TRACE_JSON_HEAD);
+  for (uint32_t i = trace_first(tr); i != tr->n_events; i++) {
+    trace_json_event(tr, i, buf, sizeof(buf));
+    out.print(buf);
+  }
+  out.print(TRACE_JSON_TAIL);
+  out.println("#end");
+
+  tr->frozen = false;
+}
+
+void trace_dump_summary(Print &out, const latency_trace *tr, uint32_t fs_ring) {
+  uint32_t n = tr->lat_count;
+  out.printf("latency: %lu packets, min %lu us, avg %lu us, max %lu us\n",
+             (unsigned long)n, (unsigned long)tr->lat_min,
+             (unsigned long)(n ? tr->lat_sum / n : 0), (unsigned long)tr->lat_max);
+  out.printf("ring: RB_SIZE=%lu, low-latency depth %lu (%lu us)\n",
+             (unsigned long)RB_SIZE, (unsigned long)LOW_LATENCY_DEPTH,
+             (unsigned long)((uint64_t)LOW_LATENCY_DEPTH * 1000000 / fs_ring));
+  out.printf("underrun: %lu of %lu ticks (%lu ppm)\n",
+             (unsigned long)tr->underrun_ticks, (unsigned long)tr->ticks,
+             (unsigned long)(tr->ticks ? (uint64_t)tr->underrun_ticks * 1000000 / tr->ticks : 0));
+  out.printf("trimmed: %lu samples in %lu packets (%lu ppm)\n",
+             (unsigned long)tr->trimmed, (unsigned long)tr->trims,
+             (unsigned long)(tr->ticks ? (uint64_t)tr->trimmed * 1000000 / tr->ticks : 0));
+
+  for (uint32_t b = 0; b <= LAT_BINS; b++) {
+    if (!tr->hist[b]) continue;
+    if (b < LAT_BINS) {
+      out.printf("  %3lu-%3lu ms %lu\n", (unsigned long)(b * LAT_BIN_US / 1000),
+                 (unsigned long)((b + 1) * LAT_BIN_US / 1000), (unsigned long)tr->hist[b]);
+    } else {
+      out.printf("  >=%3lu ms  %lu\n", (unsigned long)(b * LAT_BIN_US / 1000),
+                 (unsigned long)tr->hist[b]);
+    }
+  }
+}
@@ -1,5 +1,12 @@
 #include <Arduino.h>
 #include <BluetoothA2DPSink.h>
+#include <driver/ledc.h>
+#include <soc/ledc_struct.h>
+#include "pipeline.h"
+#include "pcm_capture.h"
+#include "udp_input.h"
+#include "latency_trace.h"
+#include "upsampler.h"
 
 // ======================= User settings =======================
 static const int PWM_PIN = 18;
@@ -7,87 +14,136 @@ static const int PWM_CH  = 0;
 static const int PWM_RES = 9;
 
 static const int FC      = 40000;   // ultrasonic carrier (LEDC base freq)
-static const int FS_ENV  = 40000;   // envelope sample rate
+static const int FS_ENV  = 44100;   // input sample rate, upsampled to FC
+static const int FS_ENV_MIN = 16000; // lowest rate A2DP can negotiate
+
+// Input samples upsampled per critical section
+static const uint32_t UP_CHUNK = 64;
 
 // Duty limits
 static const int PWM_MAX  = (1 << PWM_RES) - 1;
 static const int DUTY_MIN = (PWM_MAX * 1) / 100;
 static const int DUTY_MAX = (PWM_MAX * 99) / 100;
 
+// Input: A2DP by default, RTP/L16 over Wi-Fi with -DINPUT_UDP=1
+#if INPUT_UDP && !defined(WIFI_SSID)
+#error "INPUT_UDP needs -DWIFI_SSID=\"...\" and -DWIFI_PASS=\"...\""
+#endif
+#if INPUT_UDP
+// platformio.ini expands an unset WIFI_SSID environment variable to ""
+static_assert(sizeof(WIFI_SSID) > 1, "INPUT_UDP needs a non-empty WIFI_SSID");
+#endif
+
 // ======================= Globals ============================
+#if !INPUT_UDP
 BluetoothA2DPSink a2dp;
+#endif
 
-// Simple mono sample ring buffer (int16_t)
-static const uint32_t RB_SIZE = 512;
-static volatile int16_t rb_data[RB_SIZE];
-static volatile uint32_t rb_head = 0;  // write index
-static volatile uint32_t rb_tail = 0;  // read index
-
-// HW timer
-hw_timer_t *timer = nullptr;
-portMUX_TYPE timerMux = portMUX_INITIALIZER_UNLOCKED;
-
-// ======================= Utility ============================
-static inline uint16_t clamp_u16(uint32_t x, uint16_t lo, uint16_t hi) {
-  if (x < lo) return lo;
-  if (x > hi) return hi;
-  return (uint16_t)x;
-}
+// Sample ring between the input callback and the PWM ISR, one sample
+// per carrier period
+static sample_ring rb;
 
-static inline bool rb_is_full() {
-  uint32_t next = (rb_head + 1) & (RB_SIZE - 1);
-  return next == rb_tail;
-}
+// Input rate -> FC interpolation, only touched by the input callback.
+// A2DP reports the negotiated rate through in_rate, the callback re-inits
+// the upsampler when it changes.
+static upsampler up;
+static volatile uint32_t in_rate = FS_ENV;
 
-static inline bool rb_is_empty() {
-  return rb_head == rb_tail;
-}
-
-// push from callback
-static inline void rb_push(int16_t v) {
-  uint32_t h = rb_head;
-  uint32_t next = (h + 1) & (RB_SIZE - 1);
-  if (next == rb_tail) {
-    // overflow: drop sample
-    return;
-  }
-  rb_data[h] = v;
-  rb_head = next;
-}
+// Arrival -> output latency, guarded by timerMux like the ring
+static latency_trace tr;
 
-// pop from ISR
-static inline int16_t rb_pop_or_last(int16_t last) {
-  if (rb_is_empty()) return last;
-  uint32_t t = rb_tail;
-  int16_t v = rb_data[t];
-  rb_tail = (t + 1) & (RB_SIZE - 1);
-  return v;
-}
+// Guards the ring and the trace against the PWM ISR
+portMUX_TYPE timerMux = portMUX_INITIALIZER_UNLOCKED;
 
 // ======================= PWM ISR ============================
-void IRAM_ATTR onTimer() {
+// Runs on the LEDC timer overflow, i.e. once per carrier period. LEDC
+// latches a new duty at the next overflow, so every period gets exactly
+// one envelope sample and no write lands mid-period.
+// ledcSetup() puts channel 0 on high-speed timer 0.
+void IRAM_ATTR onCarrierPeriod(void *) {
   static int16_t last_sample = 0;
 
+  if (!LEDC.int_st.hstimer0_ovf) return;
+  LEDC.int_clr.hstimer0_ovf = 1;
+
   portENTER_CRITICAL_ISR(&timerMux);
 
   // Get next mono sample (or reuse last if buffer empty)
-  int16_t s = rb_pop_or_last(last_sample);
+  bool empty = rb_is_empty(&rb);
+  int16_t s = rb_pop_or_last(&rb, last_sample);
   last_sample = s;
 
-  // Scale from signed 16-bit to 0..32767 (envelope)
-  int32_t interp = s;             // -32768..32767
-  interp >>= 1;                   // headroom
-  interp += 16384;                // DC bias to center
-  if (interp < 0)     interp = 0;
-  if (interp > 32767) interp = 32767;
+  ledcWrite(PWM_CH, duty_from_sample(s, DUTY_MIN, DUTY_MAX));
+  trace_tick(&tr, micros(), empty);
 
-  uint32_t duty =
-      DUTY_MIN +
-      ((uint32_t)interp * (DUTY_MAX - DUTY_MIN)) / 32767;
+  portEXIT_CRITICAL_ISR(&timerMux);
+}
 
-  ledcWrite(PWM_CH, clamp_u16(duty, DUTY_MIN, DUTY_MAX));
+// ===================== Packet bookkeeping ====================
+struct packet_ctx {
+  uint16_t id;
+  uint32_t t_us;
+  uint32_t drops;
+};
+
+// Before pushing a packet: trace arrival, trim in low-latency mode and
+// trigger the capture if the ring glitched since the last packet
+static packet_ctx packet_begin(uint32_t t_us) {
+  static const uint32_t PAUSE_US = 100000;  // longer gaps are a new stream
+  static uint32_t seen_drops = 0, seen_underruns = 0, last_t_us = 0;
+  static bool streaming = false;
+  packet_ctx p;
+  portENTER_CRITICAL(&timerMux);
+  p.id = trace_packet_begin(&tr, &rb, t_us, LOW_LATENCY_DEPTH);
+  p.drops = rb.drops;
+  uint32_t underruns = rb.underruns;
+  portEXIT_CRITICAL(&timerMux);
+  p.t_us = t_us;
+
+  // The ring runs dry before the first packet and during pauses, only
+  // underruns inside a running stream are glitches
+  bool running = streaming && t_us - last_t_us < PAUSE_US;
+  if (p.drops != seen_drops || (running && underruns != seen_underruns)) {
+    pcm_capture_trigger();
+  }
+  seen_drops = p.drops;
+  seen_underruns = underruns;
+  last_t_us = t_us;
+  streaming = true;
+  return p;
+}
 
-  portEXIT_CRITICAL_ISR(&timerMux);
+// `pushed` counts ring samples, i.e. after upsampling
+static void packet_end(const packet_ctx &p, uint32_t pushed) {
+  uint32_t t_end = micros();
+  portENTER_CRITICAL(&timerMux);
+  trace_packet_end(&tr, p.id, p.t_us, t_end, pushed - (rb.drops - p.drops));
+  portEXIT_CRITICAL(&timerMux);
+}
+
+// Upsample `frames` samples spaced `stride` apart to FC and push them a
+// chunk at a time, returns the number of ring samples pushed
+static uint32_t push_upsampled(const int16_t *pcm, uint32_t frames, uint32_t stride) {
+  static int16_t buf[UP_CHUNK * ((FC + FS_ENV_MIN - 1) / FS_ENV_MIN) + 2];
+  uint32_t pushed = 0;
+
+  uint32_t rate = in_rate;
+  if (rate != up.fs_in) {
+    upsampler_init(&up, rate, FC);
+  }
+
+  for (uint32_t i = 0; i < frames; i += UP_CHUNK) {
+    uint32_t n = frames - i < UP_CHUNK ? frames - i : UP_CHUNK;
+    uint32_t m = upsample_block(&up, pcm + i * stride, n, stride, UPSAMPLE_MODE, buf);
+
+    portENTER_CRITICAL(&timerMux);
+    for (uint32_t k = 0; k < m; k++) {
+      rb_push(&rb, buf[k]);
+    }
+    portEXIT_CRITICAL(&timerMux);
+    pushed += m;
+  }
+  return pushed;
 }
 
 // ================== Bluetooth audio callback =================
@@ -95,23 +151,34 @@ void audio_data_callback(const uint8_t *data, uint32_t len) {
   const int16_t *pcm = (const int16_t *)data;
   uint32_t frames = len / 4; // stereo 16-bit
 
-  // static int32_t lp = 0;     // simple LPF state
+  packet_ctx pkt = packet_begin(micros());
+
+  // Left channel is what gets played, record it for host replay
+  pcm_capture_packet(pkt.t_us, pkt.t_us, len, pcm, frames, 2);
+
+  packet_end(pkt, push_upsampled(pcm, frames, 2));
+}
 
-  for (uint32_t i = 0; i < frames; i++) {
-    int32_t l = pcm[2 * i];
-    // int32_t r = pcm[2 * i + 1];
+// SBC runs at 16, 32, 44.1 or 48 kHz, whichever the source picked
+void sample_rate_callback(uint16_t rate) {
+  if (rate >= FS_ENV_MIN) in_rate = rate;
+}
 
-    // int32_t mono = (l + r) >> 1;
+// ===================== UDP/RTP input =========================
+#if INPUT_UDP
+static uint32_t ring_depth() {
+  return rb_depth(&rb);
+}
 
-    // simple lowpass to tame aliasing
-    //lp += (mono - lp) >> 3;
-    //int16_t out = (int16_t)lp;
+// Called from the UDP task with one jitter-buffered mono packet. Latency
+// is traced from `t_rx`, so it includes the network and jitter buffer.
+static void udp_pcm_sink(uint32_t t_rx, const int16_t *pcm, uint32_t frames) {
+  packet_ctx pkt = packet_begin(t_rx);
+  pcm_capture_packet(micros(), t_rx, 2 * frames, pcm, frames, 1);
 
-    portENTER_CRITICAL(&timerMux);
-    rb_push(l);
-    portEXIT_CRITICAL(&timerMux);
-  }
+  packet_end(pkt, push_upsampled(pcm, frames, 1));
 }
+#endif
 
 // ========================== Setup ============================
 void setup() {
@@ -123,19 +190,52 @@ void setup() {
   ledcAttachPin(PWM_PIN, PWM_CH);
   ledcWrite(PWM_CH, (DUTY_MIN + DUTY_MAX) / 2);
 
-  // Timer @ FS_ENV Hz
-  // APB = 80 MHz -> divider 80 => 1 MHz tick
-  timer = timerBegin(0, 80, true);
-  timerAttachInterrupt(timer, &onTimer, true);
-  timerAlarmWrite(timer, 1000000 / FS_ENV, true);
-  timerAlarmEnable(timer);
+  upsampler_init(&up, FS_ENV, FC);
+
+  // Duty updates on the carrier's own period event. Not an IRAM interrupt:
+  // ledcWrite() and the helpers it calls live in flash, so the ISR must
+  // stay masked while the cache is off (flash writes, e.g. BT pairing).
+  ledc_isr_register(onCarrierPeriod, nullptr, 0, nullptr);
+  LEDC.int_clr.hstimer0_ovf = 1;
+  LEDC.int_ena.hstimer0_ovf = 1;
 
+#if INPUT_UDP
+  // RTP/L16 receiver feeding the same ring
+  udp_input_begin(WIFI_SSID, WIFI_PASS, udp_pcm_sink, ring_depth);
+#else
   // Bluetooth A2DP sink, raw PCM callback
   a2dp.set_stream_reader(audio_data_callback, false);
+  a2dp.set_sample_rate_callback(sample_rate_callback);
   a2dp.start("Ultrasonic Speaker");
+#endif
 }
 
 // =========================== Loop ============================
 void loop() {
-  delay(1000);
+  static bool held_shown = false;
+  if (pcm_capture_held() != held_shown) {
+    held_shown = !held_shown;
+    if (held_shown) Serial.println("capture held after a glitch, send 'c'");
+  }
+
+  // Serial console: 'c' dumps the PCM capture, 't' the latency trace,
+  // 'l' prints the latency histogram, 's' input stats
+  while (Serial.available()) {
+    int cmd = Serial.read();
+    if (cmd == 'c') {
+      pcm_capture_dump(Serial, in_rate, FC, UPSAMPLE_MODE, DUTY_MIN, DUTY_MAX);
+    }
+    if (cmd == 't') {
+      trace_dump_json(Serial, &tr);
+    }
+    if (cmd == 'l') {
+      trace_dump_summary(Serial, &tr, FC);
+    }
+#if INPUT_UDP
+    if (cmd == 's') {
+      udp_input_stats(Serial);
+    }
+#endif
+  }
+  delay(10);
 }
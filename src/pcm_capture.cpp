@@ -0,0 +1,127 @@
+#include "pcm_capture.h"
+#include "pipeline.h"
+
+#if PCM_CAPTURE
+
+struct cap_packet {
+  uint32_t t_us;    // micros() when pushed into the ring
+  uint32_t t_rx;    // micros() at arrival
+  uint32_t len;     // packet length in bytes
+  uint32_t start;   // position of the first sample in the PCM stream
+  uint32_t frames;  // number of mono samples
+};
+
+static int16_t cap_pcm[CAPTURE_SAMPLES];
+static cap_packet cap_pkts[CAPTURE_PACKETS];
+static uint32_t cap_samples = 0;  // total samples recorded (wraps)
+static uint32_t cap_count   = 0;  // total packets recorded (wraps)
+
+// The callback may run on the other core. It raises cap_busy before it
+// looks at cap_frozen and the dump raises cap_frozen before it looks at
+// cap_busy, so at least one of them sees the other and backs off.
+static volatile bool cap_frozen = false;
+static volatile bool cap_busy   = false;
+
+// Trigger: packets still to record, then hold until the next dump
+static uint32_t cap_post = 0;
+static bool cap_armed = false;
+static volatile bool cap_held = false;
+
+void pcm_capture_trigger() {
+  if (cap_armed || cap_held) return;
+  cap_armed = true;
+  cap_post = CAPTURE_POST_PACKETS;
+}
+
+bool pcm_capture_held() {
+  return cap_held;
+}
+
+void pcm_capture_packet(uint32_t t_us, uint32_t t_rx, uint32_t len,
+                        const int16_t *pcm, uint32_t frames, uint32_t stride) {
+  cap_busy = true;
+  if (cap_frozen || cap_held) {
+    cap_busy = false;
+    return;
+  }
+
+  if (frames > CAPTURE_SAMPLES) frames = CAPTURE_SAMPLES;
+
+  cap_packet &p = cap_pkts[cap_count & (CAPTURE_PACKETS - 1)];
+  p.t_us   = t_us;
+  p.t_rx   = t_rx;
+  p.len    = len;
+  p.start  = cap_samples;
+  p.frames = frames;
+
+  uint32_t w = cap_samples;
+  for (uint32_t i = 0; i < frames; i++) {
+    cap_pcm[(w + i) & (CAPTURE_SAMPLES - 1)] = pcm[i * stride];
+  }
+  cap_samples = w + frames;
+  cap_count++;
+
+  if (cap_armed && --cap_post == 0) {
+    cap_armed = false;
+    cap_held = true;
+  }
+
+  cap_busy = false;
+}
+
+static void dump_packet(Print &out, const cap_packet &p) {
+  static const char hex[] = "0123456789abcdef";
+  char line[4 * 64 + 1];
+
+  out.printf("p %lu %lu %lu ", (unsigned long)p.t_us,
+             (unsigned long)p.len, (unsigned long)p.frames);
+
+  uint32_t i = 0;
+  while (i < p.frames) {
+    uint32_t n = 0;
+    for (; n < 64 && i < p.frames; n++, i++) {
+      uint16_t v = (uint16_t)cap_pcm[(p.start + i) & (CAPTURE_SAMPLES - 1)];
+      line[4 * n + 0] = hex[(v >> 12) & 0xF];
+      line[4 * n + 1] = hex[(v >> 8) & 0xF];
+      line[4 * n + 2] = hex[(v >> 4) & 0xF];
+      line[4 * n + 3] = hex[v & 0xF];
+    }
+    out.write((const uint8_t *)line, 4 * n);
+  }
+  // Arrival time only where it differs (UDP input)
+  if (p.t_rx != p.t_us) out.printf(" r=%lu", (unsigned long)p.t_rx);
+  out.println();
+}
+
+void pcm_capture_dump(Print &out, uint32_t fs_env, uint32_t fc, int up_mode,
+                      int duty_min, int duty_max) {
+  cap_frozen = true;
+  while (cap_busy) delay(1);
+
+  // Oldest packet whose samples have not been overwritten yet
+  uint32_t first = cap_count > CAPTURE_PACKETS ? cap_count - CAPTURE_PACKETS : 0;
+  while (first != cap_count &&
+         cap_samples - cap_pkts[first & (CAPTURE_PACKETS - 1)].start > CAPTURE_SAMPLES) {
+    first++;
+  }
+
+  out.printf("#pcmcap 2 fs_env=%lu fc=%lu up=%d rb_size=%lu duty_min=%d duty_max=%d "
+             "packets=%lu\n",
+             (unsigned long)fs_env, (unsigned long)fc, up_mode, (unsigned long)RB_SIZE,
+             duty_min, duty_max, (unsigned long)(cap_count - first));
+  if (cap_held) {
+    out.printf("#trigger glitch %lu packets before the end\n",
+               (unsigned long)CAPTURE_POST_PACKETS);
+  }
+  for (uint32_t i = first; i != cap_count; i++) {
+    dump_packet(out, cap_pkts[i & (CAPTURE_PACKETS - 1)]);
+  }
+  out.println("#end");
+
+  // Re-arm; a trigger pending during the dump is dropped with the rest
+  cap_armed = false;
+  cap_held = false;
+  cap_frozen = false;
+}
+
+#endif
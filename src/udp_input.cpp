@@ -0,0 +1,80 @@
+#include "udp_input.h"
+
+#if INPUT_UDP
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "rtp_jitter.h"
+
+static WiFiUDP udp;
+static jitter_buffer jb;
+static pcm_sink_fn sink_fn = nullptr;
+static ring_depth_fn depth_fn = nullptr;
+
+// Largest datagram accepted: RTP header + JB_MAX_FRAMES of stereo L16
+static uint8_t rx_buf[12 + 64 + 4 * JB_MAX_FRAMES];
+static int16_t play_buf[JB_MAX_FRAMES];
+
+static void udp_task(void *) {
+  for (;;) {
+    // Drain the socket into the jitter buffer
+    int n;
+    while ((n = udp.parsePacket()) > 0) {
+      int got = udp.read(rx_buf, sizeof(rx_buf));
+      rtp_packet p;
+      if (got > 0 && rtp_parse(rx_buf, (uint32_t)got, &p)) {
+        jb_put(&jb, p.seq, micros(), p.payload, p.payload_len, UDP_CHANNELS);
+      }
+    }
+
+    // Top the ring up to UDP_RING_FILL, one packet at a time
+    while (depth_fn() < UDP_RING_FILL) {
+      uint32_t frames, t_rx;
+      jb_result r = jb_get(&jb, play_buf, &frames, &t_rx);
+      if (r == JB_EMPTY) break;
+      // A concealed packet is made up now, it has no arrival time
+      sink_fn(r == JB_OK ? t_rx : micros(), play_buf, frames);
+    }
+
+    vTaskDelay(1);
+  }
+}
+
+bool udp_input_begin(const char *ssid, const char *pass,
+                     pcm_sink_fn sink, ring_depth_fn depth) {
+  sink_fn = sink;
+  depth_fn = depth;
+  jb_init(&jb, UDP_JB_TARGET);
+
+  WiFi.mode(WIFI_STA);
+  WiFi.setSleep(false);  // modem sleep adds tens of ms of jitter
+  WiFi.begin(ssid, pass);
+  uint32_t t0 = millis();
+  while (WiFi.status() != WL_CONNECTED) {
+    if (millis() - t0 > UDP_CONNECT_MS) {
+      Serial.printf("UDP input: cannot join Wi-Fi \"%s\" (status %d), no input\n",
+                    ssid, (int)WiFi.status());
+      return false;
+    }
+    delay(100);
+  }
+  Serial.print("UDP input on ");
+  Serial.print(WiFi.localIP().toString().c_str());
+  Serial.printf(":%u\n", UDP_PORT);
+
+  udp.begin(UDP_PORT);
+  xTaskCreatePinnedToCore(udp_task, "udp_in", 4096, nullptr, 5, nullptr, 1);
+  return true;
+}
+
+void udp_input_stats(Print &out) {
+  out.printf("udp: received=%lu late=%lu dup=%lu concealed=%lu overruns=%lu resyncs=%lu\n",
+             (unsigned long)jb.received, (unsigned long)jb.late,
+             (unsigned long)jb.duplicates, (unsigned long)jb.concealed,
+             (unsigned long)jb.overruns, (unsigned long)jb.resyncs);
+  out.printf("udp: buffered=%lu drained=%lu packets in %lu drains\n",
+             (unsigned long)jb.buffered, (unsigned long)jb.drained,
+             (unsigned long)jb.drains);
+}
+
+#endif
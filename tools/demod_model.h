@@ -0,0 +1,98 @@
+#pragma once
+#include <math.h>
+#include <stdint.h>
+
+// Envelope-domain model of what the air demodulates, for scoring runs
+// without a lab. The transducer only passes the carrier fundamental, whose
+// amplitude for a rectangular wave of duty D is proportional to sin(pi D).
+// Berktay's far-field solution gives the audible pressure as the second
+// time derivative of the squared envelope.
+
+// Relative carrier amplitude for a duty code, 1.0 at 50 %
+static inline float carrier_amplitude(uint32_t duty, uint32_t pwm_max) {
+  return sinf((float)M_PI * (float)duty / (float)(pwm_max + 1));
+}
+
+// Second difference of E^2, one call per envelope sample
+struct berktay_state {
+  float e2_1, e2_2;
+};
+
+static inline float berktay_step(berktay_state *st, float e) {
+  float e2 = e * e;
+  float p = e2 - 2.0f * st->e2_1 + st->e2_2;
+  st->e2_2 = st->e2_1;
+  st->e2_1 = e2;
+  return p;
+}
+
+// Plain second difference, for signals that are already squared
+struct diff2_state {
+  float x1, x2;
+};
+
+static inline float diff2_step(diff2_state *st, float x) {
+  float y = x - 2.0f * st->x1 + st->x2;
+  st->x2 = st->x1;
+  st->x1 = x;
+  return y;
+}
+
+// RBJ cookbook biquad, direct form I
+struct biquad {
+  float b0, b1, b2, a1, a2;
+  float x1, x2, y1, y2;
+};
+
+static inline biquad biquad_norm(double b0, double b1, double b2,
+                                 double a0, double a1, double a2) {
+  biquad q = {};
+  q.b0 = (float)(b0 / a0);
+  q.b1 = (float)(b1 / a0);
+  q.b2 = (float)(b2 / a0);
+  q.a1 = (float)(a1 / a0);
+  q.a2 = (float)(a2 / a0);
+  return q;
+}
+
+static inline biquad biquad_lowpass(double fc, double fs, double Q) {
+  double w0 = 2.0 * M_PI * fc / fs, c = cos(w0), alpha = sin(w0) / (2.0 * Q);
+  return biquad_norm((1 - c) / 2, 1 - c, (1 - c) / 2, 1 + alpha, -2 * c, 1 - alpha);
+}
+
+// Band-pass with 0 dB peak gain at fc
+static inline biquad biquad_bandpass(double fc, double fs, double Q) {
+  double w0 = 2.0 * M_PI * fc / fs, c = cos(w0), alpha = sin(w0) / (2.0 * Q);
+  return biquad_norm(alpha, 0, -alpha, 1 + alpha, -2 * c, 1 - alpha);
+}
+
+static inline float biquad_step(biquad *q, float x) {
+  float y = q->b0 * x + q->b1 * q->x1 + q->b2 * q->x2 - q->a1 * q->y1 - q->a2 * q->y2;
+  q->x2 = q->x1;
+  q->x1 = x;
+  q->y2 = q->y1;
+  q->y1 = y;
+  return y;
+}
+
+// Least-squares fit of the predicted output `p` to a reference `r` (the
+// input run through the same d^2/dt^2). Whatever the best gain can't
+// explain is distortion.
+struct distortion_acc {
+  double pr, rr, pp;
+};
+
+static inline void distortion_add(distortion_acc *d, float p, float r) {
+  d->pr += (double)p * r;
+  d->rr += (double)r * r;
+  d->pp += (double)p * p;
+}
+
+// Distortion to signal ratio in percent, 0 for silence
+static inline double distortion_pct(const distortion_acc *d) {
+  if (d->rr <= 0.0 || d->pp <= 0.0) return 0.0;
+  double sig = d->pr * d->pr / d->rr;  // energy of g * r
+  double err = d->pp - sig;
+  if (err < 0.0) err = 0.0;
+  return sig > 0.0 ? 100.0 * sqrt(err / sig) : 100.0;
+}
@@ -0,0 +1,455 @@
+// Parametric demodulation simulator: predicts what the listener hears from
+// the duty-code stream the firmware emits, for quality regression runs.
+//
+// Signal chain, simulated at OS samples per carrier period:
+//   duty codes at --fs-ring -> PWM carrier at FC (area-sampled edges, duty
+//   latched at the next period like LEDC, or mid-period) -> transducer
+//   band-pass around FC -> envelope^2 -> Berktay d^2/dt^2 -> audio band.
+// The firmware writes one code per carrier period, so --fs-ring defaults
+// to --fc; a different --fs-ring or --drift models a free-running
+// envelope clock.
+//
+// The reference is the intended signal (codes, or the PCM through an
+// exact cubic before quantization) put through an ideal linear AM
+// modulator, the same band-pass and a coherent demodulator, so filtering
+// and delay cancel and what is left after a gain fit is distortion and
+// noise: staircase and beat images, duty quantization, sin(pi D) and the
+// Berktay square term.
+//
+// The input is streamed a block at a time and scored as the output is
+// produced, so memory use does not grow with its length. -o writes a
+// 32-bit float WAV, normalized to -1 dBFS when the run ends.
+//
+//   g++ -O2 -std=c++17 -Iinclude tools/demod_sim.cpp -o demod_sim
+//   demod_sim in.wav|in.duty [-o audible.wav] [--fs-ring hz] [--fc hz]
+//             [--res bits] [--duty-min pct] [--duty-max pct] [--mod x]
+//             [--duty-min-code n] [--duty-max-code n] [--os n] [--q q]
+//             [--sections n] [--bw hz]
+//             [--latch period|immediate] [--drift ppm] [--tone hz]
+//             [--interp hold|linear|cubic] [--max-thd pct] [--max-dist pct]
+//             [--min-snr db]
+//
+// .duty files are raw little-endian uint16 codes at --fs-ring, as written
+// by pcm_replay -d. They carry no duty limits, so codes outside
+// --duty-min..--duty-max are refused rather than scored against a wrong
+// reference. The capture's limits are codes, not percentages: pass them
+// as --duty-min-code/--duty-max-code, as pcm_replay prints. WAV input is
+// upsampled to --fs-ring with the firmware's upsampler (--interp, cubic by
+// default like UPSAMPLE_MODE) and mapped with its duty_from_*().
+// With --max-thd (needs --tone), --max-dist or --min-snr the exit status
+// is 1 when the limits fail.
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "demod_model.h"
+#include "pipeline.h"
+#include "upsampler.h"
+#include "wav_io.h"
+
+using clk = std::chrono::steady_clock;
+
+struct options {
+  const char *in = nullptr;
+  const char *out = nullptr;
+  double fs_ring = 0;        // code rate, 0 = fc like the firmware
+  double fc = 40000;         // FC
+  int res = 9;               // PWM_RES
+  int duty_min_pct = 1;
+  int duty_max_pct = 99;
+  int duty_min_code = -1;    // override the percentages, -1 = unset
+  int duty_max_code = -1;
+  double mod = 1.0;
+  int os = 16;               // simulation samples per carrier period
+  double q = 6;              // transducer band-pass Q per section
+  int sections = 2;
+  double bw = 8000;          // audio band for output and metrics
+  bool latch_period = true;
+  double drift_ppm = 0;      // code clock error against FC
+  double tone = 0;           // test tone for THD, 0 = none
+  int interp = UPSAMPLE_CUBIC;
+  double max_thd = -1;
+  double max_dist = -1;
+  double min_snr = -1e9;
+};
+
+static const int ENV_SECTIONS = 3;  // envelope low-pass after squaring
+
+// Double-precision twin of upsample_block(): the same anti-alias filter
+// and output positions (output k at input k * fs_in / fs_out - 2) through
+// Catmull-Rom without quantization, as the reference for WAV input
+struct cubic_ref {
+  uint32_t fs_in, fs_out, phase;
+  double x0, x1, x2, x3;
+  upsample_lp lp;
+};
+
+static void cubic_ref_init(cubic_ref *r, uint32_t fs_in, uint32_t fs_out) {
+  *r = {fs_in, fs_out, 0, 0, 0, 0, 0, {}};
+  upsample_lp_init(&r->lp, fs_in, fs_out);
+}
+
+static uint32_t cubic_ref_block(cubic_ref *r, const int16_t *in, uint32_t n,
+                                uint32_t stride, double scale, float *out) {
+  uint32_t m = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    r->x0 = r->x1;
+    r->x1 = r->x2;
+    r->x2 = r->x3;
+    r->x3 = upsample_lp_step(&r->lp, in[i * stride]);
+    for (; r->phase < r->fs_out; r->phase += r->fs_in) {
+      double t = (double)r->phase / r->fs_out;
+      double x0 = r->x0, x1 = r->x1, x2 = r->x2, x3 = r->x3;
+      double y = x1 + 0.5 * t * (x2 - x0 + t * (2 * x0 - 5 * x1 + 4 * x2 - x3 +
+                                                t * (3 * (x1 - x2) + x3 - x0)));
+      out[m++] = (float)(y * scale);
+    }
+    r->phase -= r->fs_out;
+  }
+  return m;
+}
+
+// Running power of one frequency (Goertzel), fed a sample at a time
+struct goertzel {
+  double c, s1, s2;
+};
+
+static goertzel goertzel_init(double f, double fs) {
+  return {2.0 * cos(2.0 * M_PI * f / fs), 0, 0};
+}
+
+static inline void goertzel_step(goertzel *g, float x) {
+  double s = x + g->c * g->s1 - g->s2;
+  g->s2 = g->s1;
+  g->s1 = s;
+}
+
+static double goertzel_power(const goertzel *g) {
+  return g->s1 * g->s1 + g->s2 * g->s2 - g->c * g->s1 * g->s2;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+  size_t n = strlen(s), m = strlen(suffix);
+  return n >= m && !strcmp(s + n - m, suffix);
+}
+
+static const uint32_t CHUNK = 4096;  // input samples per block
+
+// Streamed input: duty codes and the intended envelope (-1..1) they stand
+// for, at --fs-ring, a block at a time so inputs of any length fit
+struct input_stream {
+  FILE *duty = nullptr;      // .duty file, or
+  wav_reader wav;            // WAV through the firmware's upsampler
+  upsampler up;
+  cubic_ref ref;
+  int duty_min, duty_max, pwm_max;
+  int lo, hi;                // code range seen in a .duty file
+  bool error = false;
+  std::vector<int16_t> in, ring;
+  std::vector<float> xbuf;
+};
+
+static bool input_open(const options &o, input_stream &st) {
+  st.pwm_max  = (1 << o.res) - 1;
+  st.duty_min = o.duty_min_code >= 0 ? o.duty_min_code
+                                     : (st.pwm_max * o.duty_min_pct) / 100;
+  st.duty_max = o.duty_max_code >= 0 ? o.duty_max_code
+                                     : (st.pwm_max * o.duty_max_pct) / 100;
+  st.lo = st.pwm_max;
+  st.hi = 0;
+
+  if (ends_with(o.in, ".duty")) {
+    st.duty = fopen(o.in, "rb");
+    st.in.resize(CHUNK);
+    return st.duty != nullptr;
+  }
+
+  if (!wav_open(o.in, st.wav)) return false;
+  uint32_t fs_ring = (uint32_t)lround(o.fs_ring);
+  upsampler_init(&st.up, st.wav.rate, fs_ring);
+  cubic_ref_init(&st.ref, st.wav.rate, fs_ring);
+  st.in.resize((size_t)CHUNK * st.wav.channels);
+  st.ring.resize(upsample_max_out(&st.up, CHUNK));
+  st.xbuf.resize(st.ring.size());
+  return true;
+}
+
+static void input_close(input_stream &st) {
+  if (st.duty) fclose(st.duty);
+  wav_close(st.wav);
+}
+
+// Append the next block to `codes`/`xref`, false at the end or on error
+static bool input_next(const options &o, input_stream &st,
+                       std::vector<uint16_t> &codes, std::vector<float> &xref) {
+  const float centre = 0.5f * (st.duty_min + st.duty_max);
+  const float half = 0.5f * (st.duty_max - st.duty_min);
+
+  if (st.duty) {
+    // Codes outside the limits would be scored against a wrong reference
+    size_t n = fread(st.in.data(), 2, CHUNK, st.duty);
+    const uint8_t *b = (const uint8_t *)st.in.data();
+    for (size_t i = 0; i < n; i++) {
+      int c = b[2 * i] | (b[2 * i + 1] << 8);
+      if (c < st.lo) st.lo = c;
+      if (c > st.hi) st.hi = c;
+      codes.push_back((uint16_t)(c > st.pwm_max ? st.pwm_max : c));
+      xref.push_back(half > 0 ? (c - centre) / half : 0.0f);
+    }
+    if (n && (st.lo < st.duty_min || st.hi > st.duty_max)) {
+      fprintf(stderr, "%s: codes %d..%d fall outside the duty limits "
+              "(%d..%d at %d bits)\n", o.in, st.lo, st.hi, st.duty_min,
+              st.duty_max, o.res);
+      st.error = true;
+      return false;
+    }
+    return n > 0;
+  }
+
+  // Left channel through the firmware's upsampler, and the reference at
+  // the same positions through the exact cubic
+  uint32_t n = (uint32_t)wav_read_frames(st.wav, st.in.data(), CHUNK);
+  uint32_t ch = st.wav.channels;
+  uint32_t m = upsample_block(&st.up, st.in.data(), n, ch, o.interp, st.ring.data());
+  cubic_ref_block(&st.ref, st.in.data(), n, ch, o.mod / 32768.0, st.xbuf.data());
+
+  const int32_t mod_q15 = (int32_t)lround(o.mod * MOD_FULL);
+  for (uint32_t i = 0; i < m; i++) {
+    int32_t e = envelope_from_sample(st.ring[i], mod_q15);
+    codes.push_back(duty_from_envelope(e, st.duty_min, st.duty_max));
+    xref.push_back(st.xbuf[i]);
+  }
+  return n > 0;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: demod_sim in.wav|in.duty [-o audible.wav] [--fs-ring hz] [--fc hz]\n"
+          "                 [--res bits] [--duty-min pct] [--duty-max pct] [--mod x]\n"
+          "                 [--duty-min-code n] [--duty-max-code n] [--os n] [--q q]\n"
+          "                 [--sections n] [--bw hz]\n"
+          "                 [--latch period|immediate] [--drift ppm] [--tone hz]\n"
+          "                 [--interp hold|linear|cubic] [--max-thd pct] [--max-dist pct]\n"
+          "                 [--min-snr db]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  options o;
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    bool has = i + 1 < argc;
+    if (!strcmp(a, "-o") && has) o.out = argv[++i];
+    else if (!strcmp(a, "--fs-ring") && has) o.fs_ring = atof(argv[++i]);
+    else if (!strcmp(a, "--fc") && has) o.fc = atof(argv[++i]);
+    else if (!strcmp(a, "--res") && has) o.res = atoi(argv[++i]);
+    else if (!strcmp(a, "--duty-min") && has) o.duty_min_pct = atoi(argv[++i]);
+    else if (!strcmp(a, "--duty-max") && has) o.duty_max_pct = atoi(argv[++i]);
+    else if (!strcmp(a, "--duty-min-code") && has) o.duty_min_code = atoi(argv[++i]);
+    else if (!strcmp(a, "--duty-max-code") && has) o.duty_max_code = atoi(argv[++i]);
+    else if (!strcmp(a, "--mod") && has) o.mod = atof(argv[++i]);
+    else if (!strcmp(a, "--os") && has) o.os = atoi(argv[++i]);
+    else if (!strcmp(a, "--q") && has) o.q = atof(argv[++i]);
+    else if (!strcmp(a, "--sections") && has) o.sections = atoi(argv[++i]);
+    else if (!strcmp(a, "--bw") && has) o.bw = atof(argv[++i]);
+    else if (!strcmp(a, "--latch") && has) o.latch_period = strcmp(argv[++i], "immediate") != 0;
+    else if (!strcmp(a, "--drift") && has) o.drift_ppm = atof(argv[++i]);
+    else if (!strcmp(a, "--tone") && has) o.tone = atof(argv[++i]);
+    else if (!strcmp(a, "--interp") && has) {
+      const char *m = argv[++i];
+      if (!strcmp(m, "hold")) o.interp = UPSAMPLE_HOLD;
+      else if (!strcmp(m, "linear")) o.interp = UPSAMPLE_LINEAR;
+      else if (!strcmp(m, "cubic")) o.interp = UPSAMPLE_CUBIC;
+      else usage();
+    }
+    else if (!strcmp(a, "--max-thd") && has) o.max_thd = atof(argv[++i]);
+    else if (!strcmp(a, "--max-dist") && has) o.max_dist = atof(argv[++i]);
+    else if (!strcmp(a, "--min-snr") && has) o.min_snr = atof(argv[++i]);
+    else if (a[0] != '-' && !o.in) o.in = a;
+    else usage();
+  }
+  if (!o.in || o.os < 4 || o.sections < 1 || o.res < 1 || o.res > 16) usage();
+  if (o.duty_max_code > (1 << o.res) - 1 ||
+      (o.duty_max_code >= 0 && o.duty_min_code >= o.duty_max_code)) {
+    fprintf(stderr, "duty codes must satisfy 0 <= min < max < 2^res\n");
+    return 2;
+  }
+  if (o.fs_ring <= 0) o.fs_ring = o.fc;
+  if (o.max_thd >= 0 && o.tone <= 0) {
+    fprintf(stderr, "--max-thd needs --tone, use --max-dist for broadband distortion\n");
+    return 2;
+  }
+
+  input_stream st;
+  if (!input_open(o, st)) {
+    fprintf(stderr, "cannot use %s\n", o.in);
+    return 1;
+  }
+
+  const int pwm_steps = 1 << o.res;
+  const double fs_sim = o.fc * o.os;
+  const double fs_out = o.fc;  // decimate by OS after the envelope filter
+  const double env_rate = o.fs_ring * (1.0 + o.drift_ppm * 1e-6);
+
+  // Transducer, identical for the PWM and the reference carrier
+  std::vector<biquad> bp_pwm(o.sections), bp_ref(o.sections);
+  for (int i = 0; i < o.sections; i++) {
+    bp_pwm[i] = bp_ref[i] = biquad_bandpass(o.fc, fs_sim, o.q);
+  }
+  biquad lp_pwm[ENV_SECTIONS], lp_ref[ENV_SECTIONS];
+  for (int i = 0; i < ENV_SECTIONS; i++) {
+    lp_pwm[i] = lp_ref[i] = biquad_lowpass(0.4 * o.fc, fs_sim, M_SQRT1_2);
+  }
+  biquad band_p = biquad_lowpass(std::min(o.bw, 0.45 * fs_out), fs_out, M_SQRT1_2);
+  biquad band_r = band_p;
+
+  std::vector<float> cosine(o.os);
+  for (int s = 0; s < o.os; s++) cosine[s] = (float)cos(2.0 * M_PI * s / o.os);
+
+  // Scored as the output comes, after the filters have settled
+  const uint64_t settle = (uint64_t)(0.02 * fs_out);
+  distortion_acc dist = {0, 0, 0};
+  std::vector<goertzel> harm;  // tone, then harmonics 2..10 in band
+  if (o.tone > 0) {
+    harm.push_back(goertzel_init(o.tone, fs_out));
+    for (int h = 2; h <= 10 && h * o.tone < std::min(o.bw, fs_out / 2); h++) {
+      harm.push_back(goertzel_init(h * o.tone, fs_out));
+    }
+  }
+  float peak = 0;
+  uint64_t n_out = 0;
+
+  wav_float_writer wav;
+  std::vector<float> wav_buf;
+  if (o.out && !wav_float_open(o.out, (uint32_t)fs_out, wav)) {
+    fprintf(stderr, "cannot write %s\n", o.out);
+    return 1;
+  }
+
+  // Codes in flight: codes[i] is code `base + i` of the stream
+  std::vector<uint16_t> codes;
+  std::vector<float> xref;
+  uint64_t base = 0;
+  bool more = true;
+
+  diff2_state dp = {0, 0}, dr = {0, 0};
+  float period_high = 0;  // high time of the current period, in sim samples
+
+  auto t_start = clk::now();
+
+  for (uint64_t n = 0;; n++) {
+    int s = (int)(n % o.os);
+    double t_env = (double)n / fs_sim * env_rate;  // position in the code stream
+    uint64_t k = (uint64_t)t_env;
+
+    // Keep codes k and k + 1 loaded, drop the ones already passed
+    while (more && k + 1 >= base + codes.size()) {
+      size_t used = (size_t)std::min<uint64_t>(k - base, codes.size());
+      codes.erase(codes.begin(), codes.begin() + used);
+      xref.erase(xref.begin(), xref.begin() + used);
+      base += used;
+      more = input_next(o, st, codes, xref);
+    }
+    if (k + 1 >= base + codes.size()) break;
+    size_t j = (size_t)(k - base);
+
+    // PWM: the duty register is sampled at period start (LEDC) or follows
+    // every write immediately
+    if (s == 0 || !o.latch_period) {
+      period_high = (float)codes[j] * o.os / pwm_steps;
+    }
+    float high = period_high - s;
+    high = high < 0 ? 0 : (high > 1 ? 1 : high);
+    float c = 2.0f * high - 1.0f;
+
+    // Reference: ideal AM of the interpolated intended signal
+    double frac = t_env - k;
+    float x = (float)(xref[j] + frac * (xref[j + 1] - xref[j]));
+    float cr = (1.0f + 0.5f * x) * cosine[s];
+
+    for (int i = 0; i < o.sections; i++) {
+      c = biquad_step(&bp_pwm[i], c);
+      cr = biquad_step(&bp_ref[i], cr);
+    }
+
+    // Envelope squared of the real chain, coherent (linear) demod of the
+    // reference
+    float e2 = 2.0f * c * c;
+    float d = 2.0f * cr * cosine[s];
+    for (int i = 0; i < ENV_SECTIONS; i++) {
+      e2 = biquad_step(&lp_pwm[i], e2);
+      d = biquad_step(&lp_ref[i], d);
+    }
+
+    if (s != o.os - 1) continue;
+
+    // Berktay: audible pressure ~ d^2/dt^2 of envelope^2
+    float audible = biquad_step(&band_p, diff2_step(&dp, e2));
+    float reference = biquad_step(&band_r, diff2_step(&dr, d));
+    if (n_out++ >= settle) {
+      distortion_add(&dist, audible, reference);
+      for (goertzel &g : harm) goertzel_step(&g, audible);
+      peak = std::max(peak, fabsf(audible));
+    }
+    if (o.out) {
+      wav_buf.push_back(audible);
+      if (wav_buf.size() == CHUNK) {
+        wav_float_write(wav, wav_buf.data(), wav_buf.size());
+        wav_buf.clear();
+      }
+    }
+  }
+
+  double wall = std::chrono::duration<double>(clk::now() - t_start).count();
+  const uint64_t n_codes = base + codes.size();
+  input_close(st);
+  if (st.error || n_codes < 2) {
+    fprintf(stderr, "cannot use %s\n", o.in);
+    return 1;
+  }
+  const double duration = n_codes / o.fs_ring;
+
+  double dist_pct = distortion_pct(&dist);
+  double snr_db = dist_pct > 0 ? -20.0 * log10(dist_pct / 100.0) : 200.0;
+
+  printf("input           %s, %llu codes at %.0f Hz (%.2f s)\n",
+         o.in, (unsigned long long)n_codes, o.fs_ring, duration);
+  printf("carrier         %.0f Hz, %d-bit, latch %s, drift %.1f ppm\n",
+         o.fc, o.res, o.latch_period ? "period" : "immediate", o.drift_ppm);
+  printf("transducer      %d x band-pass Q %.1f\n", o.sections, o.q);
+  printf("distortion      %.3f %% of signal (vs. ideal AM, %.0f Hz band)\n", dist_pct, o.bw);
+  printf("snr             %.2f dB\n", snr_db);
+
+  double thd_pct = -1;
+  if (o.tone > 0) {
+    double h1 = goertzel_power(&harm[0]);
+    double hn = 0;
+    for (size_t h = 1; h < harm.size(); h++) hn += goertzel_power(&harm[h]);
+    thd_pct = h1 > 0 ? 100.0 * sqrt(hn / h1) : 100.0;
+    printf("thd             %.3f %% at %.0f Hz (harmonics 2..10)\n", thd_pct, o.tone);
+  }
+  printf("speed           %.1fx real time\n", wall > 0 ? duration / wall : 0.0);
+
+  if (o.out) {
+    // Normalize to -1 dBFS
+    wav_float_write(wav, wav_buf.data(), wav_buf.size());
+    if (!wav_float_close(wav, (uint32_t)fs_out, peak > 0 ? 0.89f / peak : 0.0f)) {
+      fprintf(stderr, "cannot write %s\n", o.out);
+      return 1;
+    }
+  }
+
+  bool ok = snr_db >= o.min_snr && (o.max_thd < 0 || thd_pct <= o.max_thd) &&
+            (o.max_dist < 0 || dist_pct <= o.max_dist);
+  if (o.max_thd >= 0 || o.max_dist >= 0 || o.min_snr > -1e9) {
+    printf("%s\n", ok ? "PASS" : "FAIL");
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,304 @@
+// Parallel parameter sweep of the envelope pipeline over a WAV corpus.
+//
+// Every combination of the listed parameters is run over every file on all
+// cores (one work item per run, pulled from a shared queue). Each run does
+// what the firmware does to the left channel: 1-pole low-pass at the input
+// rate (the file's), upsample_block() to the carrier rate (--fc, one duty
+// code per period), envelope_from_sample() and duty_from_envelope() from
+// include/pipeline.h. The duty stream is scored with the Berktay model in
+// demod_model.h and written as one CSV row:
+//
+//   clip_pct          samples whose envelope left 0..32767
+//   mod_peak_pct      peak |duty - centre| as % of the duty half-range
+//   mod_rms_pct       same, RMS
+//   dist_pct          predicted demodulated distortion vs. the input,
+//                     both band-limited to --bw Hz (default 8000)
+//   ns_per_sample     host time of the filter, upsampler and duty mapping
+//                     per ring sample
+//   cycles_per_sample same in TSC cycles (x86 only), for relative cost
+//
+//   g++ -O2 -std=c++17 -pthread -Iinclude tools/param_sweep.cpp -o param_sweep
+//   param_sweep [-j n] [-o out.csv] [--res 9] [--duty-min 1,12]
+//               [--duty-max 82,99] [--mod 0.5,1] [--cutoff 0,7000]
+//               [--fc 40000] [--bw hz] corpus/*.wav
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#else
+#define HAVE_TSC 0
+#endif
+
+#include "demod_model.h"
+#include "pipeline.h"
+#include "upsampler.h"
+#include "wav_io.h"
+
+using clk = std::chrono::steady_clock;
+
+struct params {
+  int res;          // PWM_RES
+  int duty_min_pct;
+  int duty_max_pct;
+  double mod;       // 1.0 = MOD_FULL
+  int cutoff_hz;    // 0 = no filter
+  int fc;           // carrier = ring rate
+};
+
+struct corpus_file {
+  std::string path;
+  uint32_t rate;
+  std::vector<int16_t> left;
+};
+
+struct result {
+  uint64_t samples;
+  double clip_pct;
+  double mod_peak_pct;
+  double mod_rms_pct;
+  double dist_pct;
+  double ns_per_sample;
+  double cycles_per_sample;
+};
+
+static inline uint64_t tsc() {
+#if HAVE_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+static const uint32_t CHUNK = 4096;  // input samples per block
+
+static double audio_bw = 8000;  // band the distortion is measured in
+
+static result run(const params &p, const corpus_file &f) {
+  const int pwm_max  = (1 << p.res) - 1;
+  const int duty_min = (pwm_max * p.duty_min_pct) / 100;
+  const int duty_max = (pwm_max * p.duty_max_pct) / 100;
+  const int32_t mod_q15 = (int32_t)lround(p.mod * MOD_FULL);
+  const double centre = 0.5 * (duty_min + duty_max);
+  const double half = 0.5 * (duty_max - duty_min);
+
+  lpf1 lp = {0, 32768};
+  if (p.cutoff_hz > 0) {
+    double a = 1.0 - exp(-2.0 * M_PI * p.cutoff_hz / f.rate);
+    lp.alpha_q15 = (int32_t)lround(a * 32768);
+    if (lp.alpha_q15 < 1) lp.alpha_q15 = 1;
+  }
+
+  // Carrier amplitude per duty code, the model only needs a table lookup
+  std::vector<float> amp(pwm_max + 1);
+  for (int d = 0; d <= pwm_max; d++) amp[d] = carrier_amplitude(d, pwm_max);
+
+  upsampler up;
+  upsampler_init(&up, f.rate, p.fc);
+
+  std::vector<int16_t> fbuf(CHUNK);
+  std::vector<int16_t> env;
+  std::vector<uint16_t> duty;
+  const size_t max_out = upsample_max_out(&up, CHUNK);
+  env.resize(max_out);
+  duty.resize(max_out);
+
+  // Same low-pass on prediction and reference, so it doesn't count as error
+  double bw = std::min(audio_bw, 0.45 * p.fc);
+  biquad bp = biquad_lowpass(bw, p.fc, M_SQRT1_2);
+  biquad br = bp;
+
+  berktay_state bs = {0, 0};
+  diff2_state dr = {0, 0};  // reference second difference
+  distortion_acc dist = {0, 0, 0};
+  uint64_t n_out = 0, clips = 0;
+  double mod_peak = 0, mod_sq = 0;
+  uint64_t cycles = 0;
+  clk::duration busy{};
+
+  for (size_t off = 0; off < f.left.size(); off += CHUNK) {
+    uint32_t n_in = (uint32_t)std::min<size_t>(CHUNK, f.left.size() - off);
+
+    // Firmware work: input filter, upsampling, envelope and duty mapping
+    auto t0 = clk::now();
+    uint64_t c0 = tsc();
+    for (uint32_t i = 0; i < n_in; i++) fbuf[i] = lpf1_step(&lp, f.left[off + i]);
+    uint32_t m = upsample_block(&up, fbuf.data(), n_in, 1, UPSAMPLE_MODE, env.data());
+    for (uint32_t i = 0; i < m; i++) {
+      int32_t e = envelope_from_sample(env[i], mod_q15);
+      clips += (e < 0) | (e > 32767);
+      duty[i] = duty_from_envelope(e, duty_min, duty_max);
+    }
+    cycles += tsc() - c0;
+    busy += clk::now() - t0;
+
+    // Score
+    for (uint32_t i = 0; i < m; i++) {
+      double u = half > 0 ? fabs(duty[i] - centre) / half : 0;
+      if (u > mod_peak) mod_peak = u;
+      mod_sq += u * u;
+
+      float pr = berktay_step(&bs, amp[std::min<int>(duty[i], pwm_max)]);
+      float r = diff2_step(&dr, env[i] * (1.0f / 32768.0f));
+      distortion_add(&dist, biquad_step(&bp, pr), biquad_step(&br, r));
+    }
+
+    n_out += m;
+  }
+
+  result r = {};
+  r.samples = n_out;
+  if (n_out) {
+    double ns = std::chrono::duration<double, std::nano>(busy).count();
+    r.clip_pct = 100.0 * clips / n_out;
+    r.mod_peak_pct = 100.0 * mod_peak;
+    r.mod_rms_pct = 100.0 * sqrt(mod_sq / n_out);
+    r.dist_pct = distortion_pct(&dist);
+    r.ns_per_sample = ns / n_out;
+    r.cycles_per_sample = HAVE_TSC ? (double)cycles / n_out : 0;
+  }
+  return r;
+}
+
+template <typename T>
+static std::vector<T> parse_list(const char *s, T (*conv)(const char *)) {
+  std::vector<T> v;
+  std::string item;
+  for (const char *c = s;; c++) {
+    if (*c == ',' || *c == 0) {
+      if (!item.empty()) v.push_back(conv(item.c_str()));
+      item.clear();
+      if (*c == 0) break;
+    } else {
+      item.push_back(*c);
+    }
+  }
+  return v;
+}
+
+static int to_int(const char *s) { return atoi(s); }
+static double to_double(const char *s) { return atof(s); }
+
+static void usage() {
+  fprintf(stderr,
+          "usage: param_sweep [-j n] [-o out.csv] [--res bits] [--duty-min pct,..]\n"
+          "                   [--duty-max pct,..] [--mod x,..] [--cutoff hz,..]\n"
+          "                   [--fc hz,..] [--bw hz] file.wav...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  // Defaults are the settings in src/main.cpp; the input rate is the file's
+  std::vector<int> res = {9}, dmin = {1}, dmax = {99}, cutoff = {0}, fc = {40000};
+  std::vector<double> mod = {1.0};
+  unsigned jobs = std::thread::hardware_concurrency();
+  const char *out_path = nullptr;
+  std::vector<std::string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    bool has = i + 1 < argc;
+    if (!strcmp(a, "-j") && has) jobs = atoi(argv[++i]);
+    else if (!strcmp(a, "-o") && has) out_path = argv[++i];
+    else if (!strcmp(a, "--res") && has) res = parse_list(argv[++i], to_int);
+    else if (!strcmp(a, "--duty-min") && has) dmin = parse_list(argv[++i], to_int);
+    else if (!strcmp(a, "--duty-max") && has) dmax = parse_list(argv[++i], to_int);
+    else if (!strcmp(a, "--mod") && has) mod = parse_list(argv[++i], to_double);
+    else if (!strcmp(a, "--cutoff") && has) cutoff = parse_list(argv[++i], to_int);
+    else if (!strcmp(a, "--fc") && has) fc = parse_list(argv[++i], to_int);
+    else if (!strcmp(a, "--bw") && has) audio_bw = atof(argv[++i]);
+    else if (a[0] != '-') paths.push_back(a);
+    else usage();
+  }
+  if (paths.empty()) usage();
+  if (jobs < 1) jobs = 1;
+
+  std::vector<corpus_file> corpus;
+  double audio_s = 0;
+  for (const std::string &path : paths) {
+    wav_data w;
+    if (!wav_read(path.c_str(), w)) {
+      fprintf(stderr, "cannot read %s (16-bit PCM WAV only)\n", path.c_str());
+      return 1;
+    }
+    corpus_file f;
+    f.path = path;
+    f.rate = w.rate;
+    f.left.resize(w.samples.size() / w.channels);
+    for (size_t i = 0; i < f.left.size(); i++) f.left[i] = w.samples[i * w.channels];
+    audio_s += (double)f.left.size() / f.rate;
+    corpus.push_back(std::move(f));
+  }
+
+  std::vector<params> grid;
+  for (int r : res)
+    for (int lo : dmin)
+      for (int hi : dmax)
+        for (double m : mod)
+          for (int c : cutoff)
+            for (int f : fc) {
+              if (lo < 0 || lo >= hi || hi > 100 || r < 1 || r > 16 ||
+                  f <= 0 || m <= 0 || m > 2) {
+                fprintf(stderr, "skipping res=%d duty=%d..%d mod=%g fc=%d\n",
+                        r, lo, hi, m, f);
+                continue;
+              }
+              grid.push_back({r, lo, hi, m, c, f});
+            }
+
+  // Work queue: one item per (parameter set, file)
+  const size_t n_jobs = grid.size() * corpus.size();
+  std::vector<result> results(n_jobs);
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> done{0};
+
+  fprintf(stderr, "%zu parameter sets x %zu files on %u threads\n",
+          grid.size(), corpus.size(), jobs);
+  auto start = clk::now();
+
+  auto worker = [&]() {
+    for (size_t j; (j = next.fetch_add(1)) < n_jobs;) {
+      results[j] = run(grid[j / corpus.size()], corpus[j % corpus.size()]);
+      size_t d = done.fetch_add(1) + 1;
+      if (d % 64 == 0 || d == n_jobs) fprintf(stderr, "\r%zu/%zu runs", d, n_jobs);
+    }
+  };
+  std::vector<std::thread> pool;
+  for (unsigned t = 0; t < jobs; t++) pool.emplace_back(worker);
+  for (std::thread &t : pool) t.join();
+
+  double wall = std::chrono::duration<double>(clk::now() - start).count();
+  double total = audio_s * grid.size();
+  fprintf(stderr, "\n%.1f h of audio in %.1f s (%.1f h/min)\n",
+          total / 3600, wall, wall > 0 ? total / 60 / wall : 0);
+
+  FILE *out = out_path ? fopen(out_path, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "cannot write %s\n", out_path);
+    return 1;
+  }
+  fprintf(out, "file,res,duty_min_pct,duty_max_pct,mod,cutoff_hz,fc_hz,samples,"
+               "clip_pct,mod_peak_pct,mod_rms_pct,dist_pct,ns_per_sample,cycles_per_sample\n");
+  for (size_t j = 0; j < n_jobs; j++) {
+    const params &p = grid[j / corpus.size()];
+    const result &r = results[j];
+    fprintf(out, "%s,%d,%d,%d,%g,%d,%d,%llu,%.4f,%.2f,%.2f,%.3f,%.3f,%.2f\n",
+            corpus[j % corpus.size()].path.c_str(), p.res, p.duty_min_pct,
+            p.duty_max_pct, p.mod, p.cutoff_hz, p.fc,
+            (unsigned long long)r.samples, r.clip_pct, r.mod_peak_pct,
+            r.mod_rms_pct, r.dist_pct, r.ns_per_sample, r.cycles_per_sample);
+  }
+  if (out != stdout) fclose(out);
+  return 0;
+}
@@ -0,0 +1,326 @@
+// Host replay of a PCM capture dumped by the firmware ('c' on the serial
+// console, see include/pcm_capture.h).
+//
+// Packets are upsampled to the carrier rate with the firmware's upsampler
+// and pushed into the same sample_ring at their recorded push times,
+// while the PWM ISR is ticked once per carrier period (1e6 / FC us), so
+// overflows and underruns happen exactly where they did on the device.
+// The latency trace (include/latency_trace.h) runs along on simulated time,
+// measured from arrival (the r= stamp of UDP packets, before the jitter
+// buffer). --depth n replays in low-latency mode to tune LOW_LATENCY_DEPTH.
+//
+//   g++ -O2 -std=c++17 -Iinclude tools/pcm_replay.cpp -o pcm_replay
+//   pcm_replay capture.txt [-o out.wav] [-d out.duty] [-t trace.json]
+//              [--phase us] [--prefill n] [--depth n]
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "latency_trace.h"
+#include "pipeline.h"
+#include "upsampler.h"
+#include "wav_io.h"
+
+struct packet {
+  uint32_t t_us;
+  uint32_t t_rx;   // arrival, before the UDP jitter buffer
+  uint32_t len;
+  std::vector<int16_t> pcm;
+};
+
+struct capture {
+  uint32_t fs_env = 40000;
+  uint32_t fc = 40000;      // ring / ISR rate
+  int up_mode = UPSAMPLE_CUBIC;
+  int trigger = -1;         // packets after the glitch that held it, -1 = none
+  int duty_min = 0;
+  int duty_max = 511;
+  std::vector<packet> packets;
+};
+
+static int hexval(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static bool read_line(FILE *f, std::string &line) {
+  line.clear();
+  int c;
+  while ((c = fgetc(f)) != EOF && c != '\n') {
+    if (c != '\r') line.push_back((char)c);
+  }
+  return c != EOF || !line.empty();
+}
+
+// Serial logs usually carry boot messages around the dump, so everything
+// outside the #pcmcap .. #end block is ignored.
+static bool load_capture(const char *path, capture &cap) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "cannot open %s\n", path);
+    return false;
+  }
+
+  std::string line;
+  bool in_dump = false;
+  bool ok = false;
+
+  while (read_line(f, line)) {
+    if (line.compare(0, 7, "#pcmcap") == 0) {
+      unsigned long fs = 0, fc = 0, rb = 0, n = 0;
+      int up = UPSAMPLE_CUBIC;
+      if (sscanf(line.c_str(), "#pcmcap 2 fs_env=%lu fc=%lu up=%d rb_size=%lu "
+                 "duty_min=%d duty_max=%d packets=%lu",
+                 &fs, &fc, &up, &rb, &cap.duty_min, &cap.duty_max, &n) != 7 ||
+          fs == 0 || fc == 0) {
+        fprintf(stderr, "bad capture header: %s\n", line.c_str());
+        break;
+      }
+      if (up < UPSAMPLE_HOLD || up > UPSAMPLE_CUBIC) up = UPSAMPLE_CUBIC;
+      if (rb != RB_SIZE) {
+        fprintf(stderr, "warning: capture rb_size=%lu, host RB_SIZE=%lu\n",
+                rb, (unsigned long)RB_SIZE);
+      }
+      cap.fs_env = (uint32_t)fs;
+      cap.fc = (uint32_t)fc;
+      cap.up_mode = up;
+      cap.trigger = -1;
+      cap.packets.clear();
+      in_dump = true;
+    } else if (in_dump && line.compare(0, 8, "#trigger") == 0) {
+      sscanf(line.c_str(), "#trigger glitch %d", &cap.trigger);
+    } else if (in_dump && line == "#end") {
+      ok = true;
+      break;
+    } else if (in_dump && line.size() > 2 && line[0] == 'p') {
+      packet p;
+      unsigned long t = 0, len = 0, frames = 0;
+      int pos = 0;
+      if (sscanf(line.c_str(), "p %lu %lu %lu %n", &t, &len, &frames, &pos) != 3 ||
+          line.size() - pos < 4 * frames) {
+        fprintf(stderr, "truncated packet line %zu\n", cap.packets.size());
+        break;
+      }
+      p.t_us = (uint32_t)t;
+      p.len  = (uint32_t)len;
+      p.pcm.resize(frames);
+      const char *h = line.c_str() + pos;
+      for (unsigned long i = 0; i < frames; i++, h += 4) {
+        int v = (hexval(h[0]) << 12) | (hexval(h[1]) << 8) |
+                (hexval(h[2]) << 4) | hexval(h[3]);
+        p.pcm[i] = (int16_t)(uint16_t)v;
+      }
+      unsigned long rx = t;
+      sscanf(h, " r=%lu", &rx);
+      p.t_rx = (uint32_t)rx;
+      cap.packets.push_back(std::move(p));
+    }
+  }
+
+  fclose(f);
+  if (!ok) fprintf(stderr, "no complete #pcmcap block in %s\n", path);
+  return ok;
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: pcm_replay capture.txt [-o out.wav] [-d out.duty] [-t trace.json]\n"
+          "                  [--phase us] [--prefill n] [--depth n]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  const char *in_path = nullptr;
+  const char *wav_path = nullptr;
+  const char *duty_path = nullptr;
+  const char *trace_path = nullptr;
+  uint32_t phase_us = 0;
+  uint32_t prefill = 0;
+  uint32_t depth = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) wav_path = argv[++i];
+    else if (!strcmp(argv[i], "-d") && i + 1 < argc) duty_path = argv[++i];
+    else if (!strcmp(argv[i], "-t") && i + 1 < argc) trace_path = argv[++i];
+    else if (!strcmp(argv[i], "--phase") && i + 1 < argc) phase_us = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--prefill") && i + 1 < argc) prefill = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--depth") && i + 1 < argc) depth = atoi(argv[++i]);
+    else if (argv[i][0] != '-' && !in_path) in_path = argv[i];
+    else usage();
+  }
+  if (!in_path) usage();
+
+  capture cap;
+  if (!load_capture(in_path, cap)) return 1;
+  if (cap.packets.empty()) {
+    fprintf(stderr, "capture holds no packets\n");
+    return 1;
+  }
+
+  // One tick per carrier period; tick k is at t0 + phase + k * 1e6 / fc
+  uint64_t ticks = 0;
+
+  static sample_ring rb;
+  static latency_trace tr;
+  static upsampler up;
+  upsampler_init(&up, cap.fs_env, cap.fc);
+  std::vector<int16_t> ring_in;
+  for (uint32_t i = 0; i < prefill && i < RB_SIZE - 1; i++) rb_push(&rb, 0);
+  tr.produced = rb_depth(&rb);
+
+  std::vector<int16_t> out;
+  std::vector<uint16_t> duty;
+  int16_t last_sample = 0;
+  uint32_t min_depth = RB_SIZE, max_depth = 0;
+
+  // Underrun runs are the audible glitches, report where they start
+  uint64_t run_start = 0;
+  uint32_t run_len = 0, runs = 0;
+
+  uint64_t t0 = cap.packets[0].t_us;
+  uint64_t now = t0;              // packet clock, unwrapped
+  uint64_t next_tick = t0 + phase_us;
+  auto advance = [&]() {
+    ticks++;
+    next_tick = t0 + phase_us + ticks * 1000000 / cap.fc;
+  };
+  uint64_t max_gap = 0, samples_in = 0;
+
+  auto tick = [&](uint64_t t) {
+    uint32_t before = rb.underruns;
+    bool empty = rb_is_empty(&rb);
+    int16_t s = rb_pop_or_last(&rb, last_sample);
+    last_sample = s;
+    out.push_back(s);
+    duty.push_back(duty_from_sample(s, cap.duty_min, cap.duty_max));
+    trace_tick(&tr, (uint32_t)t, empty);
+
+    if (rb.underruns != before) {
+      if (run_len++ == 0) run_start = t;
+    } else if (run_len) {
+      if (runs++ < 20) {
+        printf("  underrun at %10.3f ms, %u ticks\n", (run_start - t0) / 1000.0, run_len);
+      }
+      run_len = 0;
+    }
+  };
+
+  static const char *const up_names[] = {"hold", "linear", "cubic"};
+  printf("replaying %zu packets, FS_ENV=%u Hz, FC=%u Hz (%s), RB_SIZE=%u\n",
+         cap.packets.size(), cap.fs_env, cap.fc, up_names[cap.up_mode],
+         (unsigned)RB_SIZE);
+  if (cap.trigger > 0 && (size_t)cap.trigger <= cap.packets.size()) {
+    const packet &g = cap.packets[cap.packets.size() - cap.trigger];
+    printf("held by a glitch seen at packet %zu (%.3f ms)\n",
+           cap.packets.size() - cap.trigger, (uint32_t)(g.t_us - cap.packets[0].t_us) / 1000.0);
+  }
+
+  for (size_t i = 0; i < cap.packets.size(); i++) {
+    const packet &p = cap.packets[i];
+    if (i > 0) {
+      // micros() wraps every ~71 min, unsigned difference handles it
+      uint32_t gap = p.t_us - cap.packets[i - 1].t_us;
+      now += gap;
+      if (gap > max_gap) max_gap = gap;
+    }
+
+    while (next_tick < now) {
+      tick(next_tick);
+      advance();
+    }
+
+    uint32_t d = rb_depth(&rb);
+    if (d < min_depth) min_depth = d;
+
+    uint16_t id = trace_packet_begin(&tr, &rb, p.t_rx, depth);
+    uint32_t drops = rb.drops;
+    ring_in.resize(upsample_max_out(&up, p.pcm.size()));
+    ring_in.resize(upsample_block(&up, p.pcm.data(), p.pcm.size(), 1,
+                                  cap.up_mode, ring_in.data()));
+    for (int16_t s : ring_in) rb_push(&rb, s);
+    trace_packet_end(&tr, id, p.t_rx, p.t_us, ring_in.size() - (rb.drops - drops));
+
+    d = rb_depth(&rb);
+    if (d > max_depth) max_depth = d;
+    samples_in += ring_in.size();
+  }
+
+  // Let the ISR drain what is left
+  while (!rb_is_empty(&rb)) {
+    tick(next_tick);
+    advance();
+  }
+  if (run_len && runs++ < 20) {
+    printf("  underrun at %10.3f ms, %u ticks\n", (run_start - t0) / 1000.0, run_len);
+  }
+
+  double span_ms = (now - t0) / 1000.0;
+  printf("span            %.3f ms\n", span_ms);
+  printf("max packet gap  %.3f ms\n", max_gap / 1000.0);
+  printf("samples in/out  %llu / %zu\n", (unsigned long long)samples_in, out.size());
+  printf("ring depth      min %u before, max %u after a packet\n", min_depth, max_depth);
+  printf("dropped         %u samples (overflow)\n", (unsigned)rb.drops);
+  printf("underruns       %u ticks in %u runs (%.0f ppm)\n", (unsigned)rb.underruns, runs,
+         tr.ticks ? 1e6 * tr.underrun_ticks / tr.ticks : 0.0);
+  if (depth) {
+    printf("low latency     trimmed to %u samples (%.2f ms) at each packet\n",
+           depth, depth * 1000.0 / cap.fc);
+    printf("trimmed         %u samples in %u packets (%.0f ppm)\n", tr.trimmed, tr.trims,
+           tr.ticks ? 1e6 * tr.trimmed / tr.ticks : 0.0);
+  }
+  if (tr.lat_count) {
+    printf("latency         min %.2f, avg %.2f, max %.2f ms over %u packets\n",
+           tr.lat_min / 1000.0, tr.lat_sum / 1000.0 / tr.lat_count,
+           tr.lat_max / 1000.0, tr.lat_count);
+    for (uint32_t b = 0; b <= LAT_BINS; b++) {
+      if (!tr.hist[b]) continue;
+      if (b < LAT_BINS) printf("  %3u-%3u ms  %u\n", b, b + 1, tr.hist[b]);
+      else              printf("  >=%3u ms   %u\n", b, tr.hist[b]);
+    }
+  }
+
+  if (wav_path && !wav_write(wav_path, cap.fc, out.data(), out.size())) {
+    fprintf(stderr, "cannot write %s\n", wav_path);
+    return 1;
+  }
+  if (trace_path) {
+    // Same JSON the device prints for 't', last TRACE_EVENTS events only
+    FILE *f = fopen(trace_path, "w");
+    if (!f) {
+      fprintf(stderr, "cannot write %s\n", trace_path);
+      return 1;
+    }
+    char buf[320];
+    fputs(TRACE_JSON_HEAD, f);
+    for (uint32_t i = trace_first(&tr); i != tr.n_events; i++) {
+      trace_json_event(&tr, i, buf, sizeof(buf));
+      fputs(buf, f);
+    }
+    fputs(TRACE_JSON_TAIL, f);
+    fclose(f);
+  }
+  if (duty_path) {
+    // Raw little-endian uint16 duty codes at FC, one per carrier period
+    FILE *f = fopen(duty_path, "wb");
+    bool ok = f && fwrite(duty.data(), 2, duty.size(), f) == duty.size();
+    if (f && fclose(f) != 0) ok = false;
+    if (!ok) {
+      fprintf(stderr, "cannot write %s\n", duty_path);
+      return 1;
+    }
+    // demod_sim needs the configured limits, not the range that was used
+    uint16_t lo = *std::min_element(duty.begin(), duty.end());
+    uint16_t hi = *std::max_element(duty.begin(), duty.end());
+    printf("duty codes      %u..%u used, limits %d..%d: demod_sim --fs-ring %lu "
+           "--duty-min-code %d --duty-max-code %d\n", lo, hi, cap.duty_min,
+           cap.duty_max, (unsigned long)cap.fc, cap.duty_min, cap.duty_max);
+  }
+  return 0;
+}
@@ -0,0 +1,294 @@
+// Loopback test of the UDP/RTP input path (include/rtp_jitter.h).
+//
+// A sender thread streams RTP/L16 to 127.0.0.1 at real time with injected
+// loss, reordering and send jitter. The receiver runs the same loop as the
+// firmware's udp_task(): drain the socket into the jitter buffer, then
+// upsample each packet to FC and top up a ring that drains at FC. Every
+// packet played as JB_OK is checked sample by sample against what was sent
+// for its sequence number.
+//
+// Halfway through, the receiver stalls for --stall ms, so the burst that
+// follows has to be drained. Over the last quarter of the stream the mean
+// jitter buffer depth and the arrival -> output latency must be back near
+// target, and the total underrun time must stay under --max-underrun.
+// --restart n restarts the sender after n packets with a sequence number
+// RESTART_BACK behind, like a new ffmpeg run; playback must follow it.
+//
+//   g++ -O2 -std=c++17 -pthread -Iinclude tools/rtp_loopback.cpp -o rtp_loopback
+//   rtp_loopback [--packets n] [--loss p] [--reorder p] [--jitter us]
+//                [--target n] [--fill n] [--seed n] [--restart n]
+//                [--stall ms] [--max-latency ms] [--max-underrun ms]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "rtp_jitter.h"
+#include "upsampler.h"
+
+using clk = std::chrono::steady_clock;
+
+static const uint32_t FS      = 44100;  // FS_ENV in src/main.cpp
+static const uint32_t FC      = 40000;  // FC, the ring drain rate
+static const uint32_t FRAMES  = 128;    // samples per packet, 2.9 ms
+static const uint16_t SEQ0    = 65000;  // start near the wrap on purpose
+static const uint16_t RESTART_BACK = 20000;
+
+struct options {
+  uint32_t packets = 1000;
+  double loss = 0.03;
+  double reorder = 0.05;
+  uint32_t jitter_us = 1500;
+  uint32_t target = 2;    // UDP_JB_TARGET in include/udp_input.h
+  uint32_t fill = 256;    // UDP_RING_FILL in include/udp_input.h, FC samples
+  uint32_t seed = 1;
+  uint32_t restart = 0;   // sender restart after this many packets, 0 = none
+  uint32_t stall_ms = 40; // receiver stall halfway through
+  double max_latency_ms = 20;
+  double max_underrun_ms = 120;
+};
+
+// Deterministic content so the receiver can verify any sequence number
+static int16_t expected_sample(uint16_t seq, uint32_t i) {
+  return (int16_t)(seq * 131u + i * 7u);
+}
+
+static void build_packet(std::vector<uint8_t> &pkt, uint16_t seq) {
+  pkt.assign(12 + 2 * FRAMES, 0);
+  uint32_t ts = (uint32_t)seq * FRAMES;
+  pkt[0] = 0x80;   // v2
+  pkt[1] = 96;     // dynamic payload type
+  pkt[2] = seq >> 8;  pkt[3] = seq & 0xFF;
+  pkt[4] = ts >> 24;  pkt[5] = ts >> 16; pkt[6] = ts >> 8; pkt[7] = ts;
+  for (uint32_t i = 0; i < FRAMES; i++) {
+    uint16_t v = (uint16_t)expected_sample(seq, i);
+    pkt[12 + 2 * i] = v >> 8;
+    pkt[13 + 2 * i] = v & 0xFF;
+  }
+}
+
+static void sender(int fd, sockaddr_in dst, options opt, uint32_t *dropped) {
+  std::mt19937 rng(opt.seed);
+  std::uniform_real_distribution<double> u(0.0, 1.0);
+  std::vector<uint8_t> pkt, held;
+  bool holding = false;
+
+  auto start = clk::now();
+  const double period_us = 1e6 * FRAMES / FS;
+
+  for (uint32_t n = 0; n < opt.packets; n++) {
+    uint16_t seq = (uint16_t)(SEQ0 + n);
+    if (opt.restart && n >= opt.restart) seq = (uint16_t)(seq - RESTART_BACK);
+    auto due = start + std::chrono::microseconds(
+        (int64_t)(n * period_us + u(rng) * opt.jitter_us));
+    std::this_thread::sleep_until(due);
+
+    if (n == opt.restart && holding) {
+      // The old sender is gone, nothing of it arrives after the new one
+      sendto(fd, held.data(), held.size(), 0, (sockaddr *)&dst, sizeof(dst));
+      holding = false;
+    }
+
+    if (u(rng) < opt.loss) {
+      (*dropped)++;
+      continue;
+    }
+    build_packet(pkt, seq);
+
+    if (!holding && u(rng) < opt.reorder) {
+      // Send this one after the next packet
+      held = pkt;
+      holding = true;
+      continue;
+    }
+    sendto(fd, pkt.data(), pkt.size(), 0, (sockaddr *)&dst, sizeof(dst));
+    if (holding) {
+      sendto(fd, held.data(), held.size(), 0, (sockaddr *)&dst, sizeof(dst));
+      holding = false;
+    }
+  }
+  if (holding) {
+    sendto(fd, held.data(), held.size(), 0, (sockaddr *)&dst, sizeof(dst));
+  }
+}
+
+int main(int argc, char **argv) {
+  options opt;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--packets")) opt.packets = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--loss")) opt.loss = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "--reorder")) opt.reorder = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "--jitter")) opt.jitter_us = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--target")) opt.target = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--fill")) opt.fill = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--seed")) opt.seed = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--restart")) opt.restart = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--stall")) opt.stall_ms = atoi(argv[i + 1]);
+    else if (!strcmp(argv[i], "--max-latency")) opt.max_latency_ms = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "--max-underrun")) opt.max_underrun_ms = atof(argv[i + 1]);
+    else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      return 2;
+    }
+  }
+
+  int rx = socket(AF_INET, SOCK_DGRAM, 0);
+  int tx = socket(AF_INET, SOCK_DGRAM, 0);
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  socklen_t alen = sizeof(addr);
+  if (rx < 0 || tx < 0 || bind(rx, (sockaddr *)&addr, sizeof(addr)) < 0 ||
+      getsockname(rx, (sockaddr *)&addr, &alen) < 0) {
+    perror("socket");
+    return 1;
+  }
+  timeval tv = {0, 1000};  // 1 ms, same cadence as vTaskDelay(1)
+  setsockopt(rx, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  static jitter_buffer jb;
+  jb_init(&jb, opt.target);
+
+  uint32_t sent_lost = 0;
+  std::thread tx_thread(sender, tx, addr, opt, &sent_lost);
+
+  uint8_t buf[1500];
+  static int16_t play[JB_MAX_FRAMES];
+  uint32_t played = 0, mismatches = 0, played_new = 0;
+  uint32_t underrun_samples = 0, underrun_at_last_rx = 0;
+
+  static upsampler up;
+  upsampler_init(&up, FS, FC);
+  std::vector<int16_t> ring_in(upsample_max_out(&up, JB_MAX_FRAMES));
+
+  // Steady state: the last quarter of the stream
+  const uint32_t steady_from = opt.packets - opt.packets / 4;
+  double depth_sum = 0, lat_sum = 0, lat_max = 0;
+  uint32_t steady_n = 0;
+  bool stalled = false;
+
+  // The ring drains at FC; pushed - elapsed * FC is its depth
+  auto start = clk::now();
+  auto last_rx = start;
+  int64_t pushed = 0;
+
+  for (;;) {
+    if (!stalled && played >= opt.packets / 2) {
+      // Receive stall (Wi-Fi retries, a busy core), datagrams queue up
+      std::this_thread::sleep_for(std::chrono::milliseconds(opt.stall_ms));
+      stalled = true;
+    }
+
+    ssize_t n;
+    while ((n = recv(rx, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+      rtp_packet p;
+      if (rtp_parse(buf, (uint32_t)n, &p)) {
+        uint32_t t_rx = (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            clk::now() - start).count();
+        jb_put(&jb, p.seq, t_rx, p.payload, p.payload_len, 1);
+      }
+      last_rx = clk::now();
+      underrun_at_last_rx = underrun_samples;
+    }
+
+    auto now = clk::now();
+    int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        now - start).count();
+    int64_t drained = now_us * FC / 1000000;
+    if (pushed < drained) {
+      // Ring ran dry: the ISR held the last sample this long
+      if (played > 0) underrun_samples += (uint32_t)(drained - pushed);
+      pushed = drained;
+    }
+
+    while (pushed - drained < (int64_t)opt.fill) {
+      uint32_t frames, t_rx;
+      jb_result r = jb_get(&jb, play, &frames, &t_rx);
+      if (r == JB_EMPTY) break;
+      if (r == JB_OK && played >= steady_from) {
+        // The packet's first sample plays once the ring ahead of it drains
+        double lat = (now_us + (pushed - drained) * 1e6 / FC - t_rx) / 1000.0;
+        lat_sum += lat;
+        if (lat > lat_max) lat_max = lat;
+        depth_sum += jb.buffered;
+        steady_n++;
+      }
+      if (r == JB_OK) {
+        uint16_t seq = (uint16_t)(jb.next_seq - 1);
+        uint16_t first_new = (uint16_t)(SEQ0 + opt.restart - RESTART_BACK);
+        if ((uint16_t)(seq - first_new) < opt.packets - opt.restart) played_new++;
+        for (uint32_t i = 0; i < frames; i++) {
+          if (play[i] != expected_sample(seq, i)) {
+            mismatches++;
+            break;
+          }
+        }
+      }
+      played++;
+      pushed += upsample_block(&up, play, frames, 1, UPSAMPLE_MODE, ring_in.data());
+    }
+
+    // Done once the sender is finished and the stream went quiet
+    if (played > 0 && now - last_rx > std::chrono::milliseconds(200)) break;
+    if (now - start > std::chrono::seconds(5) + std::chrono::microseconds(
+            (int64_t)opt.packets * FRAMES * 1000000 / FS)) {
+      fprintf(stderr, "timed out\n");
+      break;
+    }
+
+    // Block briefly for the next datagram
+    n = recv(rx, buf, sizeof(buf), MSG_PEEK);
+    (void)n;
+  }
+  tx_thread.join();
+  close(rx);
+  close(tx);
+
+  printf("sent            %u packets, %u dropped by sender\n", opt.packets, sent_lost);
+  printf("received        %u\n", jb.received);
+  printf("played          %u (%u concealed)\n", played, jb.concealed);
+  printf("late            %u\n", jb.late);
+  printf("duplicates      %u\n", jb.duplicates);
+  printf("overruns        %u\n", jb.overruns);
+  printf("resyncs         %u\n", jb.resyncs);
+  printf("drained         %u packets in %u drains\n", jb.drained, jb.drains);
+  // Only count dry ring time while the stream was still arriving
+  double underrun_ms = underrun_at_last_rx * 1000.0 / FC;
+  printf("underrun        %.1f ms (receiver stalled %u ms)\n", underrun_ms, opt.stall_ms);
+  double depth_avg = steady_n ? depth_sum / steady_n : 0;
+  double lat_avg = steady_n ? lat_sum / steady_n : 0;
+  printf("steady state    %.2f packets buffered, latency avg %.2f max %.2f ms\n",
+         depth_avg, lat_avg, lat_max);
+  printf("corrupt packets %u\n", mismatches);
+  uint32_t restarts = opt.restart && opt.restart < opt.packets ? 1 : 0;
+  if (restarts) {
+    printf("after restart   %u of %u packets played\n", played_new, opt.packets - opt.restart);
+  }
+
+  // Every packet that arrived is played intact, counted late, pushed out or
+  // drained; only lost or late packets are concealed; after a restart the
+  // new stream is what plays; and the backlog from the stall is gone by
+  // the end
+  uint32_t received = opt.packets - sent_lost;
+  bool ok = mismatches == 0 && jb.duplicates == 0 && jb.resyncs == restarts &&
+            played - jb.concealed + jb.late + jb.overruns + jb.drained + jb.buffered ==
+                received &&
+            steady_n > 0 && depth_avg <= opt.target + JB_DRAIN_MARGIN &&
+            lat_avg <= opt.max_latency_ms && underrun_ms <= opt.max_underrun_ms &&
+            jb.received == received &&
+            jb.concealed <= sent_lost + jb.late &&
+            (!restarts || 2 * played_new >= opt.packets - opt.restart);
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
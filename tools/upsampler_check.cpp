@@ -0,0 +1,149 @@
+// Host check of the envelope upsampler (include/upsampler.h).
+//
+// For every A2DP input rate into --fc:
+//   count   --hours of input in blocks of random size must give exactly
+//           ceil(n * fc / fs_in) outputs, so the ring rate cannot drift
+//           against the input however long it plays
+//   cubic   a few seconds of broadband input through UPSAMPLE_CUBIC are
+//           compared with Catmull-Rom in double at the exact positions
+//           (output k at input k * fs_in / fc - 2), computed here from
+//           the index rather than the phase accumulator. When the rate
+//           decimates, the reference is taken after the anti-alias
+//           low-pass, so this checks phase and interpolation only. The
+//           error is in LSB: the output is truncated to int16, so about
+//           0.6 LSB RMS is the floor.
+// Exits non-zero on failure.
+//
+//   g++ -O2 -std=c++17 -Iinclude tools/upsampler_check.cpp -o upsampler_check
+//   upsampler_check [--fc hz] [--hours h] [--max-err lsb] [--max-rms lsb]
+
+#include <algorithm>
+#include <math.h>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "upsampler.h"
+
+static const uint32_t RATES[] = {16000, 32000, 44100, 48000};
+static const uint32_t MAX_BLOCK = 512;  // A2DP packets are a few hundred frames
+
+// Outputs after n inputs: output k is produced once k * fs_in < n * fc
+static uint64_t expected_out(uint64_t n, uint32_t fs_in, uint32_t fc) {
+  return (n * fc + fs_in - 1) / fs_in;
+}
+
+static bool check_count(uint32_t fs_in, uint32_t fc, double hours, std::mt19937 &rng) {
+  upsampler u;
+  upsampler_init(&u, fs_in, fc);
+  std::vector<int16_t> in(MAX_BLOCK, 0), out(upsample_max_out(&u, MAX_BLOCK));
+  std::uniform_int_distribution<uint32_t> len(1, MAX_BLOCK);
+
+  // A few odd-length stops on the way, then the full run
+  const uint64_t total = (uint64_t)(hours * 3600 * fs_in) + 7;
+  uint64_t n = 0, m = 0;
+  bool ok = true;
+  while (n < total) {
+    uint32_t k = (uint32_t)std::min<uint64_t>(len(rng), total - n);
+    m += upsample_block(&u, in.data(), k, 1, UPSAMPLE_HOLD, out.data());
+    n += k;
+    if (m != expected_out(n, fs_in, fc)) {
+      ok = false;
+      break;
+    }
+  }
+  printf("count   %5u Hz  %llu in -> %llu out, expected %llu  %s\n", fs_in,
+         (unsigned long long)n, (unsigned long long)m,
+         (unsigned long long)expected_out(n, fs_in, fc), ok ? "ok" : "DRIFT");
+  return ok;
+}
+
+static bool check_cubic(uint32_t fs_in, uint32_t fc, double max_err, double max_rms,
+                        std::mt19937 &rng) {
+  // Tones across the band plus noise, below full scale so the cubic's
+  // overshoot does not clip
+  const uint32_t n = fs_in * 4;
+  std::vector<int16_t> x(n);
+  std::normal_distribution<double> noise(0.0, 1500.0);
+  for (uint32_t i = 0; i < n; i++) {
+    double t = (double)i / fs_in;
+    double v = 6000 * sin(2 * M_PI * 440 * t) + 4000 * sin(2 * M_PI * 3100 * t) +
+               2000 * sin(2 * M_PI * 0.31 * fs_in * t) + noise(rng);
+    x[i] = (int16_t)lrint(v);
+  }
+
+  // Reference input: the same low-pass the upsampler applies, unrounded
+  std::vector<double> xr(n);
+  upsample_lp lp;
+  upsample_lp_init(&lp, fs_in, fc);
+  for (uint32_t i = 0; i < n; i++) xr[i] = upsample_lp_step(&lp, x[i]);
+  auto at = [&](int64_t i) { return i < 0 || i >= (int64_t)n ? 0.0 : xr[i]; };
+
+  upsampler u;
+  upsampler_init(&u, fs_in, fc);
+  std::vector<int16_t> out(upsample_max_out(&u, MAX_BLOCK));
+  std::uniform_int_distribution<uint32_t> len(1, MAX_BLOCK);
+
+  double err_max = 0, err_sq = 0, sig_sq = 0;
+  uint64_t k = 0;
+  for (uint32_t i = 0; i < n;) {
+    uint32_t b = std::min(len(rng), n - i);
+    uint32_t m = upsample_block(&u, &x[i], b, 1, UPSAMPLE_CUBIC, out.data());
+    for (uint32_t j = 0; j < m; j++, k++) {
+      // Position k * fs_in / fc - 2 split exactly into index and fraction
+      uint64_t num = k * fs_in;
+      int64_t p = (int64_t)(num / fc) - 2;
+      double t = (double)(num % fc) / fc;
+      double x0 = at(p - 1), x1 = at(p), x2 = at(p + 1), x3 = at(p + 2);
+      double y = x1 + 0.5 * t * (x2 - x0 + t * (2 * x0 - 5 * x1 + 4 * x2 - x3 +
+                                                t * (3 * (x1 - x2) + x3 - x0)));
+      double e = out[j] - y;
+      err_max = std::max(err_max, fabs(e));
+      err_sq += e * e;
+      sig_sq += y * y;
+    }
+    i += b;
+  }
+
+  double rms = k ? sqrt(err_sq / k) : 0;
+  double snr = err_sq > 0 ? 10 * log10(sig_sq / err_sq) : 200.0;
+  bool ok = k == expected_out(n, fs_in, fc) && err_max <= max_err && rms <= max_rms;
+  printf("cubic   %5u Hz  %llu out, error max %.2f rms %.2f LSB, snr %.1f dB  %s\n",
+         fs_in, (unsigned long long)k, err_max, rms, snr, ok ? "ok" : "FAIL");
+  return ok;
+}
+
+static void usage() {
+  fprintf(stderr, "usage: upsampler_check [--fc hz] [--hours h] [--max-err lsb] "
+                  "[--max-rms lsb]\n");
+  exit(2);
+}
+
+int main(int argc, char **argv) {
+  uint32_t fc = 40000;
+  double hours = 1.0;
+  double max_err = 2.0;  // float cubic, Q15 fraction, truncation to int16
+  double max_rms = 1.0;
+
+  for (int i = 1; i < argc; i++) {
+    const char *a = argv[i];
+    bool has = i + 1 < argc;
+    if (!strcmp(a, "--fc") && has) fc = (uint32_t)atoi(argv[++i]);
+    else if (!strcmp(a, "--hours") && has) hours = atof(argv[++i]);
+    else if (!strcmp(a, "--max-err") && has) max_err = atof(argv[++i]);
+    else if (!strcmp(a, "--max-rms") && has) max_rms = atof(argv[++i]);
+    else usage();
+  }
+  if (fc == 0 || hours < 0) usage();
+
+  std::mt19937 rng(1);
+  bool ok = true;
+  for (uint32_t fs : RATES) ok &= check_count(fs, fc, hours, rng);
+  for (uint32_t fs : RATES) ok &= check_cubic(fs, fc, max_err, max_rms, rng);
+
+  printf("%s\n", ok ? "PASS" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,209 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Minimal 16-bit PCM WAV reader/writer for the host tools, plus a float
+// writer for outputs too long to keep in memory.
+
+struct wav_data {
+  uint32_t rate = 0;
+  uint16_t channels = 0;
+  std::vector<int16_t> samples;  // interleaved
+};
+
+static inline uint32_t wav_u32(const uint8_t *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint16_t wav_u16(const uint8_t *p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// Streaming reader: wav_open() parses the header and leaves the file at
+// the first sample, wav_read_frames() then hands out interleaved frames.
+struct wav_reader {
+  FILE *f = nullptr;
+  uint32_t rate = 0;
+  uint16_t channels = 0;
+  uint32_t left = 0;  // data bytes not read yet
+};
+
+static inline void wav_close(wav_reader &r) {
+  if (r.f) fclose(r.f);
+  r.f = nullptr;
+}
+
+static inline bool wav_open(const char *path, wav_reader &r) {
+  r.f = fopen(path, "rb");
+  if (!r.f) return false;
+  FILE *f = r.f;
+
+  uint8_t hdr[12];
+  bool ok = fread(hdr, 1, 12, f) == 12 &&
+            memcmp(hdr, "RIFF", 4) == 0 && memcmp(hdr + 8, "WAVE", 4) == 0;
+  bool have_fmt = false;
+
+  while (ok) {
+    uint8_t ck[8];
+    if (fread(ck, 1, 8, f) != 8) { ok = false; break; }
+    uint32_t size = wav_u32(ck + 4);
+
+    if (memcmp(ck, "fmt ", 4) == 0) {
+      uint8_t fmt[16];
+      if (size < 16 || fread(fmt, 1, 16, f) != 16) { ok = false; break; }
+      // PCM or WAVE_FORMAT_EXTENSIBLE, 16-bit only
+      uint16_t tag = wav_u16(fmt);
+      r.channels = wav_u16(fmt + 2);
+      r.rate     = wav_u32(fmt + 4);
+      ok = (tag == 1 || tag == 0xFFFE) && wav_u16(fmt + 14) == 16 && r.channels > 0;
+      have_fmt = true;
+      fseek(f, (long)(size - 16 + (size & 1)), SEEK_CUR);
+    } else if (memcmp(ck, "data", 4) == 0) {
+      ok = have_fmt;
+      r.left = size;
+      break;
+    } else {
+      fseek(f, (long)(size + (size & 1)), SEEK_CUR);
+    }
+  }
+
+  if (!ok) wav_close(r);
+  return ok;
+}
+
+// Read up to `frames` frames into `buf`, returns the number read
+static inline size_t wav_read_frames(wav_reader &r, int16_t *buf, size_t frames) {
+  size_t frame_bytes = 2u * r.channels;
+  size_t want = frames * frame_bytes;
+  if (want > r.left) want = r.left - r.left % frame_bytes;
+  uint8_t *raw = (uint8_t *)buf;
+  size_t got = r.f ? fread(raw, 1, want, r.f) : 0;
+  r.left = got < want ? 0 : r.left - (uint32_t)got;
+  size_t n = got / frame_bytes;
+  // Little-endian bytes to samples in place, each sample in its own slot
+  for (size_t i = 0; i < n * r.channels; i++) buf[i] = (int16_t)wav_u16(raw + 2 * i);
+  return n;
+}
+
+static inline bool wav_read(const char *path, wav_data &w) {
+  wav_reader r;
+  if (!wav_open(path, r)) return false;
+  w.rate = r.rate;
+  w.channels = r.channels;
+  w.samples.resize(r.left / 2);
+  size_t frames = wav_read_frames(r, w.samples.data(), r.left / (2u * r.channels));
+  w.samples.resize(frames * r.channels);
+  wav_close(r);
+  return true;
+}
+
+static inline void wav_put32(uint8_t *p, uint32_t v) {
+  p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline bool wav_write(const char *path, uint32_t rate,
+                             const int16_t *mono, size_t n) {
+  FILE *f = fopen(path, "wb");
+  if (!f) return false;
+
+  uint8_t hdr[44];
+  memcpy(hdr, "RIFF", 4);
+  wav_put32(hdr + 4, (uint32_t)(36 + 2 * n));
+  memcpy(hdr + 8, "WAVEfmt ", 8);
+  wav_put32(hdr + 16, 16);
+  hdr[20] = 1; hdr[21] = 0;             // PCM
+  hdr[22] = 1; hdr[23] = 0;             // mono
+  wav_put32(hdr + 24, rate);
+  wav_put32(hdr + 28, rate * 2);
+  hdr[32] = 2; hdr[33] = 0;             // block align
+  hdr[34] = 16; hdr[35] = 0;            // bits per sample
+  memcpy(hdr + 36, "data", 4);
+  wav_put32(hdr + 40, (uint32_t)(2 * n));
+
+  bool ok = fwrite(hdr, 1, 44, f) == 44;
+  for (size_t i = 0; ok && i < n; i++) {
+    uint8_t b[2] = {(uint8_t)mono[i], (uint8_t)((uint16_t)mono[i] >> 8)};
+    ok = fwrite(b, 1, 2, f) == 2;
+  }
+  return fclose(f) == 0 && ok;
+}
+
+// Incremental mono 32-bit float writer for long simulations: samples are
+// appended as they are produced, and wav_float_close() fills in the sizes
+// and scales the data in place, so nothing has to stay in memory.
+struct wav_float_writer {
+  FILE *f = nullptr;
+  uint32_t n = 0;  // samples written
+  bool ok = false;
+};
+
+static inline void wav_float_header(uint8_t *hdr, uint32_t rate, uint32_t n) {
+  memcpy(hdr, "RIFF", 4);
+  wav_put32(hdr + 4, 36 + 4 * n);
+  memcpy(hdr + 8, "WAVEfmt ", 8);
+  wav_put32(hdr + 16, 16);
+  hdr[20] = 3; hdr[21] = 0;             // IEEE float
+  hdr[22] = 1; hdr[23] = 0;             // mono
+  wav_put32(hdr + 24, rate);
+  wav_put32(hdr + 28, rate * 4);
+  hdr[32] = 4; hdr[33] = 0;             // block align
+  hdr[34] = 32; hdr[35] = 0;            // bits per sample
+  memcpy(hdr + 36, "data", 4);
+  wav_put32(hdr + 40, 4 * n);
+}
+
+static inline bool wav_float_open(const char *path, uint32_t rate,
+                                  wav_float_writer &w) {
+  w.f = fopen(path, "w+b");
+  w.n = 0;
+  if (!w.f) return w.ok = false;
+  uint8_t hdr[44];
+  wav_float_header(hdr, rate, 0);
+  return w.ok = fwrite(hdr, 1, 44, w.f) == 44;
+}
+
+static inline void wav_float_put(uint8_t *p, float v) {
+  uint32_t u;
+  memcpy(&u, &v, 4);
+  wav_put32(p, u);
+}
+
+static inline bool wav_float_write(wav_float_writer &w, const float *x, size_t n) {
+  uint8_t b[4];
+  for (size_t i = 0; w.ok && i < n; i++) {
+    wav_float_put(b, x[i]);
+    w.ok = fwrite(b, 1, 4, w.f) == 4;
+  }
+  w.n += (uint32_t)n;
+  return w.ok;
+}
+
+// Finish the file, multiplying every sample by `gain` and clamping to +-1
+static inline bool wav_float_close(wav_float_writer &w, uint32_t rate, float gain) {
+  if (!w.f) return false;
+  bool ok = w.ok;
+  uint8_t hdr[44];
+  wav_float_header(hdr, rate, w.n);
+  ok = ok && fseek(w.f, 0, SEEK_SET) == 0 && fwrite(hdr, 1, 44, w.f) == 44;
+
+  uint8_t buf[4096];
+  for (uint32_t done = 0; ok && done < w.n;) {
+    uint32_t k = w.n - done < 1024 ? w.n - done : 1024;
+    long at = 44 + 4L * done;
+    ok = fseek(w.f, at, SEEK_SET) == 0 && fread(buf, 4, k, w.f) == k;
+    for (uint32_t i = 0; ok && i < k; i++) {
+      uint32_t u = wav_u32(buf + 4 * i);
+      float v;
+      memcpy(&v, &u, 4);
+      v *= gain;
+      wav_float_put(buf + 4 * i, v > 1.0f ? 1.0f : (v < -1.0f ? -1.0f : v));
+    }
+    ok = ok && fseek(w.f, at, SEEK_SET) == 0 && fwrite(buf, 4, k, w.f) == k;
+    done += k;
+  }
+  ok = fclose(w.f) == 0 && ok;
+  w.f = nullptr;
+  return ok;
+}